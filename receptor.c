@@ -17,11 +17,15 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
 #include "receptor.h"
 
-// Variables globales para el buffer y los mutex
-struct Operaciones buffer[BUFFER_TAM];
+// Variables globales para el planificador y los mutex
+// Clases de prioridad en el orden en que se atienden
+struct ClasePrioridad clases[NUM_CLASES];
 // Contador de cuantas operaciones hay en el buffer
 int bufferCont = 0;
 pthread_mutex_t mutex;
@@ -29,18 +33,178 @@ pthread_cond_t cond_no_lleno = PTHREAD_COND_INITIALIZER;
 pthread_cond_t cond_no_vacio = PTHREAD_COND_INITIALIZER;
 // Se usa para saber cuando se terminan los hilos
 int terminar = 0;
+// Tabla de solicitantes con operaciones en curso y respuestas por enviar, y total de operaciones admitidas sin responder
+struct Cliente clientes[MAX_CLIENTES];
+int enVuelo = 0;
+pthread_mutex_t mutexClientes = PTHREAD_MUTEX_INITIALIZER;
+// Respuestas enviadas y llamadas a writev usadas para enviarlas, y respuestas descartadas porque el
+// solicitante no vaciaba su pipe y ya tenía el máximo en espera
+long respuestasEnviadas = 0;
+long escriturasSalida = 0;
+long respuestasDescartadas = 0;
+// Pool con los títulos de todos los libros, compartido por las sucursales. Solo un hilo a la vez agrega títulos
+struct PoolNombres nombres;
+pthread_mutex_t mutexNombres = PTHREAD_MUTEX_INITIALIZER;
+// Sucursales cargadas, en el orden en que se pasaron con -f
+struct Sucursal sucursales[MAX_SUCURSALES];
+int numSucursales = 0;
+// Mutex y condición para esperar a que terminen las recargas en curso
+pthread_mutex_t mutexRecarga = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t condRecarga = PTHREAD_COND_INITIALIZER;
+// Indica que el receptor está guardando el estado final y ya no acepta recargas
+int recargasCerradas = 0;
+// Último día revisado por el hilo de vencimientos
+int diaActual = 0;
+// Archivo donde se graba la traza (NULL si no se pidió), su mutex y el instante en que empezó
+FILE *traza = NULL;
+pthread_mutex_t mutexTraza = PTHREAD_MUTEX_INITIALIZER;
+long long inicioTraza = 0;
 
-// Función que lee la base de datos de libros desde un archivo de texto y la carga en memoria
-int leerDB(char *nomArchivo, struct Libros *libros) {
+// Devuelve el tiempo actual en milisegundos según el reloj monotónico
+long long tiempoMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Busca al solicitante en la tabla. Si no está y crear es 1 lo registra en una entrada libre o,
+// si no hay, en la de un solicitante sin operaciones ni respuestas pendientes (cerrando su pipe).
+// Se llama con mutexClientes tomado. Devuelve NULL si no está o no hay espacio
+static struct Cliente *buscarCliente(int pid, int crear) {
+    struct Cliente *libre = NULL, *inactivo = NULL;
+    for (int i = 0; i < MAX_CLIENTES; i++) {
+        struct Cliente *c = &clientes[i];
+        if (c->pid == pid) {
+            return c;
+        }
+        if (c->pid == 0 && !libre) {
+            libre = c;
+        } else if (c->pid != 0 && c->enCurso == 0 && c->numPendientes == 0 && !inactivo) {
+            inactivo = c;
+        }
+    }
+    if (!crear) {
+        return NULL;
+    }
+    if (!libre && inactivo) {
+        if (inactivo->fd >= 0) {
+            close(inactivo->fd);
+        }
+        libre = inactivo;
+    }
+    if (libre) {
+        libre->pid = pid;
+        libre->enCurso = 0;
+        libre->fd = -1;
+        libre->numPendientes = 0;
+        libre->lleno = 0;
+    }
+    return libre;
+}
+
+// Decide si una operación se puede encolar sin superar los límites por solicitante y global.
+// Si no se admite, deja en esperaMs cuánto debería esperar el solicitante antes de reintentar
+int admitir(struct Operaciones *op, int *esperaMs) {
+    pthread_mutex_lock(&mutexClientes);
+    // Se busca al solicitante en la tabla, o un espacio libre para registrarlo
+    struct Cliente *c = buscarCliente(op->pid, 1);
+    // Se rechaza si se supera algún límite o no hay espacio para otro solicitante
+    if (!c || c->enCurso >= MAX_POR_CLIENTE || enVuelo >= MAX_EN_VUELO) {
+        *esperaMs = REINTENTO_MS * (enVuelo + 1);
+        pthread_mutex_unlock(&mutexClientes);
+        return 0;
+    }
+    c->enCurso++;
+    enVuelo++;
+    pthread_mutex_unlock(&mutexClientes);
+    return 1;
+}
+
+// Descuenta una operación ya respondida (o descartada) de los contadores de admisión
+void liberar(int pid) {
+    pthread_mutex_lock(&mutexClientes);
+    struct Cliente *c = buscarCliente(pid, 0);
+    if (c && c->enCurso > 0) {
+        c->enCurso--;
+        enVuelo--;
+    }
+    pthread_mutex_unlock(&mutexClientes);
+}
+
+// Calcula el hash FNV-1a de un título
+static unsigned hashNombre(const char *nombre) {
+    unsigned h = 2166136261u;
+    for (; *nombre; nombre++) {
+        h = (h ^ (unsigned char)*nombre) * 16777619u;
+    }
+    return h;
+}
+
+// Busca el id de un título en el pool. Devuelve -1 si no está.
+// Puede correr a la vez que internarNombre: un título solo aparece en la tabla cuando ya está completo
+int buscarNombre(struct PoolNombres *pool, const char *nombre) {
+    unsigned h = hashNombre(nombre);
+    for (unsigned i = h & (TAM_TABLA_NOMBRES - 1);; i = (i + 1) & (TAM_TABLA_NOMBRES - 1)) {
+        int id = __atomic_load_n(&pool->tabla[i], __ATOMIC_ACQUIRE) - 1;
+        if (id < 0) {
+            return -1;
+        }
+        if (pool->hash[id] == h && strcmp(pool->datos + pool->inicio[id], nombre) == 0) {
+            return id;
+        }
+    }
+}
+
+// Guarda un título en el pool si no estaba y devuelve su id, o -1 si el pool está lleno.
+// El pool solo crece, así que los ids ya entregados siguen valiendo después de recargar el catálogo.
+// Las cargas de varias sucursales agregan títulos a la vez, así que se turnan con mutexNombres
+int internarNombre(struct PoolNombres *pool, const char *nombre) {
+    pthread_mutex_lock(&mutexNombres);
+    int id = buscarNombre(pool, nombre);
+    if (id >= 0) {
+        pthread_mutex_unlock(&mutexNombres);
+        return id;
+    }
+    int largo = strlen(nombre) + 1;
+    if (pool->cont == MAX_NOMBRES || pool->usado + largo > TAM_POOL) {
+        pthread_mutex_unlock(&mutexNombres);
+        printf("No hay espacio para guardar el título %s\n", nombre);
+        return -1;
+    }
+    id = pool->cont;
+    pool->inicio[id] = pool->usado;
+    pool->hash[id] = hashNombre(nombre);
+    memcpy(pool->datos + pool->usado, nombre, largo);
+    pool->usado += largo;
+    pool->cont++;
+    //Se ocupa la primera casilla libre a partir de la posición del hash
+    unsigned i = pool->hash[id] & (TAM_TABLA_NOMBRES - 1);
+    while (pool->tabla[i] != 0) {
+        i = (i + 1) & (TAM_TABLA_NOMBRES - 1);
+    }
+    __atomic_store_n(&pool->tabla[i], id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&mutexNombres);
+    return id;
+}
+
+// Devuelve el título que corresponde a un id del pool
+const char *nombreDe(struct PoolNombres *pool, int id) {
+    return id >= 0 ? pool->datos + pool->inicio[id] : "";
+}
+
+// Función que lee la base de datos de libros desde un archivo de texto y la carga en memoria.
+// Devuelve -1 si el archivo no se puede abrir o algún título no cabe en el pool de nombres
+int leerDB(char *nomArchivo, struct Catalogo *cat) {
     // Se abre el archivo en modo lectura y se verifica que se haya creado correctamente
     FILE *archivo = fopen(nomArchivo, "r");
     if (!archivo) {
         printf("Error al abrir el archivo %s\n", nomArchivo);
-        exit(1);
+        return -1;
     }
 
-    //Char que contendrá la linea leída
+    //Char que contendrá la linea leída y el título del libro
     char linea[256];
+    char nombre[250];
     //Contador de libros leídos
     int cont = 0;
     // While que va hasta que no lea mas líneas en el archivo o sobrepase el máximo de libros
@@ -50,18 +214,25 @@ int leerDB(char *nomArchivo, struct Libros *libros) {
         // Elimina el salto de línea
         linea[strcspn(linea, "\n")] = 0;
         // Salta a la siguiente iteración si es inválido
-        if (sscanf(linea, "%249[^,],%d,%d", libros[cont].nombre, &libros[cont].isbn, &libros[cont].numEj) == 3) {
-            if (libros[cont].numEj <= 0 || libros[cont].numEj > MAX_EJEMPLAR) {
-                printf("Número de ejemplares inválido para ISBN %d: %d\n", libros[cont].isbn, libros[cont].numEj);
+        if (sscanf(linea, "%249[^,],%d,%d", nombre, &cat->isbn[cont], &cat->numEj[cont]) == 3) {
+            if (cat->numEj[cont] <= 0 || cat->numEj[cont] > MAX_EJEMPLAR) {
+                printf("Número de ejemplares inválido para ISBN %d: %d\n", cat->isbn[cont], cat->numEj[cont]);
                 continue;
             }
-            printf("Libro leído: %s, ISBN: %d, NumEj: %d\n", libros[cont].nombre, libros[cont].isbn, libros[cont].numEj);
+            //El título se guarda una sola vez en el pool y el libro solo conserva su id. Si no cabe se rechaza
+            //la base de datos completa, un libro sin título no se podría buscar ni guardar
+            cat->idNombre[cont] = internarNombre(&nombres, nombre);
+            if (cat->idNombre[cont] < 0) {
+                fclose(archivo);
+                return -1;
+            }
+            printf("Libro leído: %s, ISBN: %d, NumEj: %d\n", nombre, cat->isbn[cont], cat->numEj[cont]);
             //Leer ejemplares de libros
-            for (int i = 0; i < libros[cont].numEj && fgets(linea, sizeof(linea), archivo); i++) {
+            for (int i = 0; i < cat->numEj[cont] && fgets(linea, sizeof(linea), archivo); i++) {
                 // Elimina salto de línea
                 linea[strcspn(linea, "\n")] = 0;
                 //Se guarda en un puntero para hacer los cambios con mayor comodidad
-                struct Ejemplar *e = &libros[cont].ejemplares[i];
+                struct Ejemplar *e = &cat->ejemplares[cont][i];
                 //Char para guardar de  manera efectiva la fecha del ejemplar
                 char fecha_str[11];
                 //Verifica que la fecha tenga el formato válido y las guarda por separado en un entero, para luego guardarla
@@ -87,41 +258,344 @@ int leerDB(char *nomArchivo, struct Libros *libros) {
     }
     //Cierra el archivo
     fclose(archivo);
+    cat->numLibros = cont;
     return cont;
 }
 
-//Añade una operación al buffer compartido, esperando si está lleno
+// Busca un libro por isbn e id de título. Devuelve su posición o -1
+static int buscarLibro(struct Catalogo *cat, int isbn, int idNombre) {
+    for (int i = 0; i < cat->numLibros; i++) {
+        if (cat->isbn[i] == isbn && cat->idNombre[i] == idNombre) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Busca un ejemplar de un libro por su número. Devuelve su posición o -1
+static int buscarEjemplar(struct Catalogo *cat, int libro, int numero) {
+    for (int j = 0; j < cat->numEj[libro]; j++) {
+        if (cat->ejemplares[libro][j].numero == numero) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+// Arma en nuevo el catálogo que resulta de aplicar el archivo leido sobre el actual.
+// Completo: quedan solo los libros y ejemplares de leido. Delta: se agregan a actual los libros y ejemplares nuevos.
+// En ambos casos los ejemplares que ya existían conservan su estado y fecha de préstamo
+void combinarCatalogo(struct Catalogo *nuevo, struct Catalogo *leido, struct Catalogo *actual, int completo) {
+    memcpy(nuevo, completo ? leido : actual, sizeof(struct Catalogo));
+    for (int i = 0; i < leido->numLibros; i++) {
+        int l = buscarLibro(completo ? actual : nuevo, leido->isbn[i], leido->idNombre[i]);
+        if (completo) {
+            //Se copia el estado vivo de los ejemplares que ya existían
+            for (int j = 0; l >= 0 && j < nuevo->numEj[i]; j++) {
+                int e = buscarEjemplar(actual, l, nuevo->ejemplares[i][j].numero);
+                if (e >= 0) {
+                    nuevo->ejemplares[i][j] = actual->ejemplares[l][e];
+                }
+            }
+        } else if (l < 0) {
+            //Libro nuevo en el delta
+            if (nuevo->numLibros == MAX_LIBROS) {
+                printf("No hay espacio para el libro ISBN %d\n", leido->isbn[i]);
+                continue;
+            }
+            l = nuevo->numLibros++;
+            nuevo->isbn[l] = leido->isbn[i];
+            nuevo->idNombre[l] = leido->idNombre[i];
+            nuevo->numEj[l] = leido->numEj[i];
+            memcpy(nuevo->ejemplares[l], leido->ejemplares[i], sizeof(nuevo->ejemplares[l]));
+        } else {
+            //Libro existente: solo se agregan los ejemplares que no tenía
+            for (int j = 0; j < leido->numEj[i]; j++) {
+                if (buscarEjemplar(nuevo, l, leido->ejemplares[i][j].numero) >= 0) {
+                    continue;
+                }
+                if (nuevo->numEj[l] == MAX_EJEMPLAR) {
+                    printf("No hay espacio para más ejemplares del ISBN %d\n", leido->isbn[i]);
+                    break;
+                }
+                nuevo->ejemplares[l][nuevo->numEj[l]++] = leido->ejemplares[i][j];
+            }
+        }
+    }
+    //El heap de vencimientos se reconstruye para las nuevas posiciones de los libros
+    heapIniciar(nuevo);
+}
+
+// Registra una sucursal a partir del argumento de -f, que es 'nombre=archivo' o solo 'archivo'.
+// Sin nombre se usa el del archivo sin ruta ni extensión. Devuelve 0 si no caben más o el nombre se repite
+int agregarSucursal(const char *arg) {
+    if (numSucursales == MAX_SUCURSALES) {
+        printf("Solo se permiten %d sucursales\n", MAX_SUCURSALES);
+        return 0;
+    }
+    struct Sucursal *suc = &sucursales[numSucursales];
+    const char *igual = strchr(arg, '=');
+    if (igual) {
+        snprintf(suc->nombre, sizeof(suc->nombre), "%.*s", (int)(igual - arg), arg);
+        snprintf(suc->archivo, sizeof(suc->archivo), "%s", igual + 1);
+    } else {
+        const char *base = strrchr(arg, '/');
+        base = base ? base + 1 : arg;
+        const char *punto = strrchr(base, '.');
+        int largo = punto && punto != base ? (int)(punto - base) : (int)strlen(base);
+        snprintf(suc->nombre, sizeof(suc->nombre), "%.*s", largo, base);
+        snprintf(suc->archivo, sizeof(suc->archivo), "%s", arg);
+    }
+    if (suc->nombre[0] == '\0' || suc->archivo[0] == '\0' || buscarSucursal(suc->nombre) >= 0) {
+        printf("Sucursal inválida o repetida: %s\n", arg);
+        return 0;
+    }
+    pthread_mutex_init(&suc->mutex, NULL);
+    numSucursales++;
+    return 1;
+}
+
+// Devuelve el índice de la sucursal con ese nombre o -1 si no existe
+int buscarSucursal(const char *nombre) {
+    for (int s = 0; s < numSucursales; s++) {
+        if (strcmp(sucursales[s].nombre, nombre) == 0) {
+            return s;
+        }
+    }
+    return -1;
+}
+
+// Hilo que carga la base de datos de una sucursal al iniciar. Las sucursales se cargan en paralelo
+void *cargarSucursal(void *args) {
+    struct Sucursal *suc = (struct Sucursal *)args;
+    suc->catalogo = calloc(1, sizeof(struct Catalogo));
+    //leerDB también falla si algún título no cabe en el pool compartido, y entonces no arranca el receptor
+    if (!suc->catalogo || leerDB(suc->archivo, suc->catalogo) <= 0) {
+        printf("Error cargando la base de datos de la sucursal %s\n", suc->nombre);
+        return (void *)1;
+    }
+    //Se indexan por fecha de entrega los ejemplares que ya estaban prestados
+    heapIniciar(suc->catalogo);
+    return NULL;
+}
+
+// Lanza en segundo plano la recarga del catálogo de una sucursal desde un archivo. Devuelve 0 si ya había una en curso
+// y -1 si el receptor está terminando
+int iniciarRecarga(int sucursal, const char *archivo, int completo) {
+    pthread_mutex_lock(&mutexRecarga);
+    if (recargasCerradas) {
+        pthread_mutex_unlock(&mutexRecarga);
+        return -1;
+    }
+    if (sucursales[sucursal].recargando) {
+        pthread_mutex_unlock(&mutexRecarga);
+        return 0;
+    }
+    sucursales[sucursal].recargando = 1;
+    pthread_mutex_unlock(&mutexRecarga);
+
+    struct Recarga *pedido = malloc(sizeof(struct Recarga));
+    pedido->sucursal = sucursal;
+    snprintf(pedido->archivo, sizeof(pedido->archivo), "%s", archivo);
+    pedido->completo = completo;
+    pthread_t hilo;
+    pthread_create(&hilo, NULL, auxiliarRecarga, pedido);
+    pthread_detach(hilo);
+    return 1;
+}
+
+// Hilo que lee el archivo y arma el nuevo catálogo aparte, sin detener el procesamiento de operaciones.
+// Mientras arma la copia solo toma la sucursal para sacar una foto del catálogo actual y, al final,
+// para publicar el nuevo. Si entretanto hubo préstamos o devoluciones, vuelve a combinar con una foto nueva;
+// tras INTENTOS_RECARGA fallidos combina con el catálogo vivo y el mutex tomado, para no reintentar sin fin
+void *auxiliarRecarga(void *args) {
+    struct Recarga *pedido = (struct Recarga *)args;
+    struct Sucursal *suc = &sucursales[pedido->sucursal];
+    struct Catalogo *leido = calloc(1, sizeof(struct Catalogo));
+    struct Catalogo *foto = malloc(sizeof(struct Catalogo));
+    struct Catalogo *nuevo = malloc(sizeof(struct Catalogo));
+    int numLibros = leido && foto && nuevo ? leerDB(pedido->archivo, leido) : -1;
+
+    if (numLibros < 0 || (pedido->completo && numLibros == 0)) {
+        printf("Recarga cancelada: no se pudo leer el catálogo %s\n", pedido->archivo);
+        free(nuevo);
+    } else {
+        int publicado = 0;
+        for (int intento = 0; intento < INTENTOS_RECARGA && !publicado; intento++) {
+            pthread_mutex_lock(&suc->mutex);
+            memcpy(foto, suc->catalogo, sizeof(struct Catalogo));
+            pthread_mutex_unlock(&suc->mutex);
+
+            combinarCatalogo(nuevo, leido, foto, pedido->completo);
+
+            //Se publica solo si ningún ejemplar cambió desde la foto
+            pthread_mutex_lock(&suc->mutex);
+            struct Catalogo *viejo = suc->catalogo;
+            if (viejo->version == foto->version) {
+                suc->catalogo = nuevo;
+                publicado = 1;
+            }
+            pthread_mutex_unlock(&suc->mutex);
+            if (publicado) {
+                free(viejo);
+            }
+        }
+        //Con tráfico constante la versión siempre cambia, así que se combina con las operaciones detenidas.
+        //Son a lo sumo MAX_LIBROS * MAX_EJEMPLAR ejemplares, la espera es corta
+        if (!publicado) {
+            pthread_mutex_lock(&suc->mutex);
+            struct Catalogo *viejo = suc->catalogo;
+            combinarCatalogo(nuevo, leido, viejo, pedido->completo);
+            suc->catalogo = nuevo;
+            pthread_mutex_unlock(&suc->mutex);
+            free(viejo);
+        }
+        printf("Catálogo de %s recargado desde %s: %d libros\n", suc->nombre, pedido->archivo, nuevo->numLibros);
+    }
+    free(leido);
+    free(foto);
+    free(pedido);
+
+    pthread_mutex_lock(&mutexRecarga);
+    suc->recargando = 0;
+    pthread_cond_broadcast(&condRecarga);
+    pthread_mutex_unlock(&mutexRecarga);
+    return NULL;
+}
+
+// Hilo que espera SIGHUP para recargar por completo la base de datos de cada sucursal
+void *auxiliarSenales(void *args) {
+    sigset_t senales;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGHUP);
+    int senal;
+    while (sigwait(&senales, &senal) == 0) {
+        for (int s = 0; s < numSucursales; s++) {
+            if (iniciarRecarga(s, sucursales[s].archivo, 1) == 0) {
+                printf("Ya hay una recarga del catálogo de %s en curso\n", sucursales[s].nombre);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Define el orden de las clases de prioridad a partir de una cadena como "DPR" (primero devoluciones).
+// Devuelve 0 si la cadena no es una permutación de D, P y R
+int configurarClases(const char *orden) {
+    if (strlen(orden) != NUM_CLASES || !strchr(orden, 'D') || !strchr(orden, 'P') || !strchr(orden, 'R')) {
+        return 0;
+    }
+    memset(clases, 0, sizeof(clases));
+    int pesos[NUM_CLASES] = PESOS_CLASES;
+    for (int i = 0; i < NUM_CLASES; i++) {
+        clases[i].tipo = orden[i];
+        clases[i].peso = pesos[i];
+        clases[i].credito = pesos[i];
+    }
+    return 1;
+}
+
+// Busca la cola del solicitante en la clase, o una libre si aún no tiene. Devuelve NULL si no hay espacio
+static struct ColaCliente *buscarCola(struct ClasePrioridad *clase, int pid) {
+    struct ColaCliente *libre = NULL;
+    for (int i = 0; i < MAX_CLIENTES; i++) {
+        struct ColaCliente *cola = &clase->colas[i];
+        if (cola->cont > 0 && cola->pid == pid) {
+            return cola->cont < MAX_POR_CLIENTE ? cola : NULL;
+        }
+        if (cola->cont == 0 && !libre) {
+            libre = cola;
+        }
+    }
+    return libre;
+}
+
+//Añade una operación a la cola de su solicitante dentro de su clase, esperando si está lleno
 void anadirBuffer(struct Operaciones *op) {
     // Bloquea el mutex para acceso exclusivo al buffer
     pthread_mutex_lock(&mutex);
-    // Espera si el buffer está lleno y manda la señal de esperar en caso de que lo este
-    while (bufferCont >= BUFFER_TAM) {
+    //Se busca la clase que corresponde al tipo de operación
+    struct ClasePrioridad *clase = &clases[0];
+    for (int i = 0; i < NUM_CLASES; i++) {
+        if (clases[i].tipo == op->tipo) {
+            clase = &clases[i];
+        }
+    }
+    // Espera si el buffer o la cola del solicitante están llenos
+    struct ColaCliente *cola;
+    while (bufferCont >= BUFFER_TAM || (cola = buscarCola(clase, op->pid)) == NULL) {
         pthread_cond_wait(&cond_no_lleno, &mutex);
     }
-    // Añade la operación y aumenta el contador
-    buffer[bufferCont++] = *op;
+    // Añade la operación al final de la cola y aumenta el contador
+    cola->pid = op->pid;
+    cola->ops[(cola->inicio + cola->cont) % MAX_POR_CLIENTE] = *op;
+    cola->cont++;
+    bufferCont++;
     // Notifica que hay datos disponibles
     pthread_cond_signal(&cond_no_vacio);
     //Libera el mutex
     pthread_mutex_unlock(&mutex);
 }
-//Lee y elimina una operación del buffer compartido, esperando si está vacío
+//Lee y elimina la siguiente operación según prioridad y turno de solicitante, esperando si está vacío
 struct Operaciones leerBuffer() {
     // Bloquea el mutex para acceso exclusivo al buffer
     pthread_mutex_lock(&mutex);
-    // Espera en caso de que el buffer este vacio, evitando cualquier problema
+    // Espera en caso de que el buffer este vacio, evitando cualquier problema. Antes de dormir termina el lote:
+    // se envían todas las respuestas acumuladas, fuera del mutex, y se vuelve a revisar el buffer
     while (bufferCont == 0 && !terminar) {
-        pthread_cond_wait(&cond_no_vacio, &mutex);
+        pthread_mutex_unlock(&mutex);
+        vaciarRespuestas(1);
+        pthread_mutex_lock(&mutex);
+        if (bufferCont == 0 && !terminar) {
+            pthread_cond_wait(&cond_no_vacio, &mutex);
+        }
     }
 
     // Libera el mutex si no hay más datos
     if (bufferCont == 0) {
         pthread_mutex_unlock(&mutex);
-        struct Operaciones op = {'Q', "", 0, 0};
+        struct Operaciones op = {'Q', -1, 0, 0, 0, 0, 0};
         return op;
     }
-    // Extrae operaciones de forma LIFO
-    struct Operaciones op = buffer[--bufferCont];
+    // Se toma la clase de mayor prioridad con operaciones a la que le quede crédito en la ronda y, dentro de ella,
+    // el siguiente solicitante en turno, para que uno solo no acapare al hilo. Si ninguna clase con operaciones
+    // tiene crédito empieza una ronda nueva, así una carga sostenida de una clase no deja sin turno a las demás
+    struct Operaciones op;
+    struct ClasePrioridad *elegida = NULL;
+    for (int ronda = 0; ronda < 2 && !elegida; ronda++) {
+        if (ronda == 1) {
+            for (int i = 0; i < NUM_CLASES; i++) {
+                clases[i].credito = clases[i].peso;
+            }
+        }
+        for (int i = 0; i < NUM_CLASES && !elegida; i++) {
+            struct ClasePrioridad *clase = &clases[i];
+            struct ColaCliente *cola = NULL;
+            for (int k = 0; k < MAX_CLIENTES && !cola && clase->credito > 0; k++) {
+                int idx = (clase->turno + k) % MAX_CLIENTES;
+                if (clase->colas[idx].cont > 0) {
+                    cola = &clase->colas[idx];
+                    clase->turno = (idx + 1) % MAX_CLIENTES;
+                }
+            }
+            if (!cola) {
+                continue;
+            }
+            // Extrae la operación más antigua del solicitante y registra cuánto esperó
+            op = cola->ops[cola->inicio];
+            cola->inicio = (cola->inicio + 1) % MAX_POR_CLIENTE;
+            cola->cont--;
+            clase->credito--;
+            long long espera = tiempoMs() - op.llegada;
+            clase->atendidas++;
+            clase->esperaTotalMs += espera;
+            if (espera > clase->esperaMaxMs) {
+                clase->esperaMaxMs = espera;
+            }
+            elegida = clase;
+        }
+    }
+    bufferCont--;
     //Da la señal de que no está lleno el buffer
     pthread_cond_signal(&cond_no_lleno);
     //Libera el mutex
@@ -129,67 +603,533 @@ struct Operaciones leerBuffer() {
     return op;
 }
 
-// Envía una respuesta al solicitante a través de un pipe nombrado específico
-void enviarRespuesta(int pid, const char *mensaje) {
-    //Char que guardara la respuesta
-    char pipe2[20];
-    // Construye el nombre del pipe a partir del pid mandado en la operación
-    snprintf(pipe2, sizeof(pipe2), "pipe_%d", pid);
-    int fd = -1, intentos = 5;
-
-        //Da 5 intentos al pipe para abrirse
-    while (intentos-- > 0) {
-        // Intenta abrir el pipe de respuesta
-        fd = open(pipe2, O_WRONLY);
-        // Sale del bucle si se abre con éxito
-        if (fd >= 0) { 
+// Muestra, por clase de prioridad, cuántas operaciones se atendieron y cuánto esperaron en cola
+void reporteEspera() {
+    pthread_mutex_lock(&mutex);
+    printf("Espera en cola por clase:\n");
+    for (int i = 0; i < NUM_CLASES; i++) {
+        struct ClasePrioridad *clase = &clases[i];
+        int pendientes = 0;
+        for (int k = 0; k < MAX_CLIENTES; k++) {
+            pendientes += clase->colas[k].cont;
+        }
+        printf("%c: atendidas %ld, pendientes %d, espera promedio %lld ms, espera máxima %lld ms\n", clase->tipo, clase->atendidas,
+               pendientes, clase->atendidas ? clase->esperaTotalMs / clase->atendidas : 0, clase->esperaMaxMs);
+    }
+    pthread_mutex_unlock(&mutex);
+    pthread_mutex_lock(&mutexClientes);
+    printf("Respuestas enviadas: %ld en %ld escrituras (%.2f escrituras por respuesta)\n", respuestasEnviadas, escriturasSalida,
+           respuestasEnviadas ? (double)escriturasSalida / respuestasEnviadas : 0.0);
+    if (respuestasDescartadas > 0) {
+        printf("Respuestas descartadas por pipes llenos: %ld\n", respuestasDescartadas);
+    }
+    pthread_mutex_unlock(&mutexClientes);
+}
+
+// Convierte una fecha dd-mm-aaaa en días, con meses de 30 días como en el resto del receptor
+int fechaOrdinal(const char *fecha) {
+    int dia = 1, mes = 1, anio = 0;
+    sscanf(fecha, "%d-%d-%d", &dia, &mes, &anio);
+    return anio * 360 + (mes - 1) * 30 + (dia - 1);
+}
+
+// Convierte un número de días de nuevo en una fecha dd-mm-aaaa
+void ordinalFecha(int ordinal, char *fecha) {
+    unsigned dias = ordinal;
+    snprintf(fecha, 11, "%02u-%02u-%04u", dias % 30 + 1, dias / 30 % 12 + 1, dias / 360 % 10000);
+}
+
+// Devuelve la fecha del sistema en días. Los días 31 se toman como 30
+int fechaHoy() {
+    time_t t = time(NULL);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    int dia = tm.tm_mday > 30 ? 30 : tm.tm_mday;
+    return (tm.tm_year + 1900) * 360 + tm.tm_mon * 30 + (dia - 1);
+}
+
+// Intercambia dos nodos del heap manteniendo actualizadas sus posiciones
+static void heapIntercambiar(struct HeapVencimientos *hv, int a, int b) {
+    struct Vencimiento tmp = hv->nodos[a];
+    hv->nodos[a] = hv->nodos[b];
+    hv->nodos[b] = tmp;
+    hv->posicion[hv->nodos[a].libro][hv->nodos[a].ejemplar] = a;
+    hv->posicion[hv->nodos[b].libro][hv->nodos[b].ejemplar] = b;
+}
+
+// Reubica un nodo subiendo o bajando hasta que se cumpla el orden del heap
+static void heapReubicar(struct HeapVencimientos *hv, int i) {
+    struct Vencimiento *n = hv->nodos;
+    while (i > 0 && n[i].fecha < n[(i - 1) / 2].fecha) {
+        heapIntercambiar(hv, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int menor = i, izq = 2 * i + 1, der = 2 * i + 2;
+        if (izq < hv->cont && n[izq].fecha < n[menor].fecha) menor = izq;
+        if (der < hv->cont && n[der].fecha < n[menor].fecha) menor = der;
+        if (menor == i) break;
+        heapIntercambiar(hv, i, menor);
+        i = menor;
+    }
+}
+
+// Construye el heap con los ejemplares que ya estaban prestados en la base de datos
+void heapIniciar(struct Catalogo *cat) {
+    struct HeapVencimientos *hv = &cat->vencimientos;
+    hv->cont = 0;
+    memset(hv->posicion, -1, sizeof(hv->posicion));
+    for (int i = 0; i < cat->numLibros; i++) {
+        for (int j = 0; j < cat->numEj[i]; j++) {
+            if (cat->ejemplares[i][j].status == 'P') {
+                heapActualizar(cat, i, j);
+            }
+        }
+    }
+}
+
+// Inserta un ejemplar prestado o actualiza su fecha de entrega en O(log n)
+void heapActualizar(struct Catalogo *cat, int libro, int ejemplar) {
+    struct HeapVencimientos *hv = &cat->vencimientos;
+    struct Ejemplar *e = &cat->ejemplares[libro][ejemplar];
+    int i = hv->posicion[libro][ejemplar];
+    if (i < 0) {
+        i = hv->cont++;
+        hv->posicion[libro][ejemplar] = i;
+    }
+    hv->nodos[i].fecha = fechaOrdinal(e->fecha);
+    hv->nodos[i].libro = libro;
+    hv->nodos[i].ejemplar = ejemplar;
+    e->vencido = hv->nodos[i].fecha < diaActual;
+    heapReubicar(hv, i);
+}
+
+// Quita del heap un ejemplar devuelto en O(log n)
+void heapQuitar(struct Catalogo *cat, int libro, int ejemplar) {
+    struct HeapVencimientos *hv = &cat->vencimientos;
+    int i = hv->posicion[libro][ejemplar];
+    if (i < 0) {
+        return;
+    }
+    cat->ejemplares[libro][ejemplar].vencido = 0;
+    hv->posicion[libro][ejemplar] = -1;
+    //El último nodo ocupa el lugar del que se quita
+    if (i != --hv->cont) {
+        hv->nodos[i] = hv->nodos[hv->cont];
+        hv->posicion[hv->nodos[i].libro][hv->nodos[i].ejemplar] = i;
+        heapReubicar(hv, i);
+    }
+}
+
+// Llena res con hasta k ejemplares (todos si k <= 0) cuya entrega es anterior a fecha, del más atrasado al menos.
+// Solo recorre los nodos vencidos y sus hijos, sin revisar todo el catálogo
+int listarVencidos(struct Catalogo *cat, int fecha, int k, struct Vencimiento *res) {
+    struct HeapVencimientos *hv = &cat->vencimientos;
+    struct Vencimiento *n = hv->nodos;
+    //Heap auxiliar con los índices candidatos, empezando por la raíz
+    int cand[MAX_LIBROS * MAX_EJEMPLAR];
+    int numCand = 0, total = 0;
+    if (hv->cont > 0 && n[0].fecha < fecha) {
+        cand[numCand++] = 0;
+    }
+    while (numCand > 0 && (k <= 0 || total < k)) {
+        //Se saca el candidato con la fecha más antigua
+        int actual = cand[0];
+        cand[0] = cand[--numCand];
+        for (int i = 0;;) {
+            int menor = i, izq = 2 * i + 1, der = 2 * i + 2;
+            if (izq < numCand && n[cand[izq]].fecha < n[cand[menor]].fecha) menor = izq;
+            if (der < numCand && n[cand[der]].fecha < n[cand[menor]].fecha) menor = der;
+            if (menor == i) break;
+            int tmp = cand[i]; cand[i] = cand[menor]; cand[menor] = tmp;
+            i = menor;
+        }
+        res[total++] = n[actual];
+        //Sus hijos pasan a ser candidatos si también están vencidos
+        for (int h = 2 * actual + 1; h <= 2 * actual + 2; h++) {
+            if (h < hv->cont && n[h].fecha < fecha) {
+                int i = numCand++;
+                cand[i] = h;
+                while (i > 0 && n[cand[i]].fecha < n[cand[(i - 1) / 2]].fecha) {
+                    int tmp = cand[i]; cand[i] = cand[(i - 1) / 2]; cand[(i - 1) / 2] = tmp;
+                    i = (i - 1) / 2;
+                }
+            }
+        }
+    }
+    return total;
+}
+
+// Responde una consulta V: la fecha de corte viene ya resuelta (0 para hoy) y el isbn indica cuántos listar
+void consultaVencidos(struct Operaciones *op) {
+    int fecha = op->fecha ? op->fecha : fechaHoy();
+    char fechaStr[11];
+    ordinalFecha(fecha, fechaStr);
+
+    struct Vencimiento res[MAX_LIBROS * MAX_EJEMPLAR];
+    struct Sucursal *suc = &sucursales[op->sucursal];
+    pthread_mutex_lock(&suc->mutex);
+    struct Catalogo *cat = suc->catalogo;
+    int total = listarVencidos(cat, fecha, op->isbn, res);
+    //Se arma la respuesta con tantos ejemplares como quepan en el mensaje
+    char respuesta[256];
+    int largo = snprintf(respuesta, sizeof(respuesta), "Vencidos al %s: %d", fechaStr, total);
+    for (int i = 0; i < total && largo < (int)sizeof(respuesta); i++) {
+        char fechaEj[11];
+        ordinalFecha(res[i].fecha, fechaEj);
+        largo += snprintf(respuesta + largo, sizeof(respuesta) - largo, "; ISBN %d Ej %d (%s)",
+                          cat->isbn[res[i].libro], cat->ejemplares[res[i].libro][res[i].ejemplar].numero, fechaEj);
+    }
+    pthread_mutex_unlock(&suc->mutex);
+    enviarRespuesta(op->pid, respuesta);
+}
+
+// Marca como vencidos los ejemplares con entrega anterior a hoy. Como el heap está ordenado,
+// solo se recorren los nodos vencidos y no todo el catálogo. Devuelve cuántos se marcaron por primera vez
+static int marcarVencidos(struct Catalogo *cat, int hoy) {
+    struct HeapVencimientos *hv = &cat->vencimientos;
+    int pila[MAX_LIBROS * MAX_EJEMPLAR];
+    int numPila = 0, nuevos = 0;
+    if (hv->cont > 0) {
+        pila[numPila++] = 0;
+    }
+    while (numPila > 0) {
+        int i = pila[--numPila];
+        struct Vencimiento *n = &hv->nodos[i];
+        if (n->fecha >= hoy) {
+            continue;
+        }
+        struct Ejemplar *e = &cat->ejemplares[n->libro][n->ejemplar];
+        if (!e->vencido) {
+            e->vencido = 1;
+            nuevos++;
+        }
+        for (int h = 2 * i + 1; h <= 2 * i + 2 && h < hv->cont; h++) {
+            pila[numPila++] = h;
+        }
+    }
+    return nuevos;
+}
+
+// Hilo que, cada vez que cambia el día, marca los ejemplares prestados que pasaron su fecha de entrega
+void *auxiliarVencidos(void *args) {
+    int ultimoDia = -1;
+    //terminar se cambia con el mutex del buffer tomado, así que se consulta con el mismo mutex
+    while (1) {
+        pthread_mutex_lock(&mutex);
+        int fin = terminar;
+        pthread_mutex_unlock(&mutex);
+        if (fin) {
             break;
         }
-        usleep(100000); // Espera para reintentar
+        int hoy = fechaHoy();
+        if (hoy != ultimoDia) {
+            __atomic_store_n(&diaActual, hoy, __ATOMIC_RELAXED);
+            for (int s = 0; s < numSucursales; s++) {
+                pthread_mutex_lock(&sucursales[s].mutex);
+                int nuevos = marcarVencidos(sucursales[s].catalogo, hoy);
+                pthread_mutex_unlock(&sucursales[s].mutex);
+                if (nuevos > 0) {
+                    printf("%s: %d ejemplares prestados pasaron su fecha de entrega\n", sucursales[s].nombre, nuevos);
+                }
+            }
+            ultimoDia = hoy;
+        }
+        sleep(REVISION_VENCIDOS);
+    }
+    return NULL;
+}
+
+// Devuelve el tiempo actual en microsegundos según el reloj monotónico
+static long long tiempoUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Abre el archivo de traza y escribe su encabezado. Devuelve 0 si no se pudo crear
+int abrirTraza(const char *archivo) {
+    traza = fopen(archivo, "wb");
+    if (!traza) {
+        return 0;
+    }
+    fwrite(MAGIA_TRAZA, 1, 4, traza);
+    inicioTraza = tiempoUs();
+    return 1;
+}
+
+// Escribe el inicio de un registro: su tipo y los microsegundos desde que empezó la traza
+static void trazaRegistro(char tipo) {
+    long long t = tiempoUs() - inicioTraza;
+    fwrite(&tipo, 1, 1, traza);
+    fwrite(&t, sizeof(t), 1, traza);
+}
+
+// Graba una operación tal como se decodificó, con el título en texto para poder reenviarla
+void trazaOperacion(struct Operaciones *op, const char *nombre, int plazo) {
+    if (!traza) {
+        return;
+    }
+    unsigned char largo = strlen(nombre);
+    pthread_mutex_lock(&mutexTraza);
+    trazaRegistro(TRAZA_OPERACION);
+    fwrite(&op->tipo, 1, 1, traza);
+    fwrite(&op->isbn, sizeof(int), 1, traza);
+    fwrite(&op->pid, sizeof(int), 1, traza);
+    fwrite(&plazo, sizeof(int), 1, traza);
+    fwrite(&op->sucursal, sizeof(int), 1, traza);
+    fwrite(&largo, 1, 1, traza);
+    fwrite(nombre, 1, largo, traza);
+    pthread_mutex_unlock(&mutexTraza);
+}
+
+// Graba una respuesta enviada a un solicitante
+void trazaRespuesta(int pid, const char *mensaje) {
+    if (!traza) {
+        return;
+    }
+    unsigned short largo = strlen(mensaje);
+    pthread_mutex_lock(&mutexTraza);
+    trazaRegistro(TRAZA_RESPUESTA);
+    fwrite(&pid, sizeof(int), 1, traza);
+    fwrite(&largo, sizeof(largo), 1, traza);
+    fwrite(mensaje, 1, largo, traza);
+    pthread_mutex_unlock(&mutexTraza);
+}
+
+// Graba el estado final de todas las sucursales con el mismo formato de guardarSalida y cierra la traza
+void cerrarTraza() {
+    if (!traza) {
+        return;
+    }
+    char *estado = NULL;
+    size_t tam = 0;
+    FILE *mem = open_memstream(&estado, &tam);
+    if (mem) {
+        //El estado de las sucursales va una tras otra, en el orden de -f
+        for (int s = 0; s < numSucursales; s++) {
+            escribirSalida(mem, sucursales[s].catalogo);
+        }
+        fclose(mem);
+        unsigned largo = tam;
+        trazaRegistro(TRAZA_ESTADO);
+        fwrite(&largo, sizeof(largo), 1, traza);
+        fwrite(estado, 1, largo, traza);
+        free(estado);
     }
+    fclose(traza);
+    traza = NULL;
+}
 
+// Abre el pipe de respuesta de un solicitante con un solo intento y sin bloquearse, porque se llama desde el hilo
+// que lee el pipe del receptor y desde los trabajadores con la sucursal tomada. El solicitante mantiene su pipe
+// abierto mientras espera, así que si no existe (ENOENT) o nadie lo lee (ENXIO) ya terminó. Devuelve -1 si no se pudo.
+// El descriptor queda sin bloqueo: las escrituras se hacen con mutexClientes tomado y un solicitante que
+// no lee su pipe no debe detener al receptor
+static int abrirPipeRespuesta(int pid) {
+    //Char que guardara la respuesta
+    char pipe2[20];
+    // Construye el nombre del pipe a partir del pid mandado en la operación
+    snprintf(pipe2, sizeof(pipe2), "pipe_%d", pid);
+    int fd = open(pipe2, O_WRONLY | O_NONBLOCK);
     // Muestra error si no se abre
     if (fd < 0) {
         printf("No se pudo abrir el pipe %s\n", pipe2);
+    }
+    return fd;
+}
+
+// Envía de una sola vez, con writev, todas las respuestas pendientes de un solicitante.
+// Se llama con mutexClientes tomado
+static void vaciarCliente(struct Cliente *c) {
+    if (c->numPendientes == 0 || c->fd < 0) {
         return;
     }
+    struct iovec iov[MAX_RESP_PENDIENTES];
+    for (int k = 0; k < c->numPendientes; k++) {
+        iov[k].iov_base = c->respuestas[k];
+        iov[k].iov_len = c->largo[k] + 1;
+    }
+    escriturasSalida++;
+    // Escribe los mensajes en el pipe y manda error en caso de no poder enviarlos. El lote mide a lo sumo
+    // MAX_RESP_PENDIENTES * 256 bytes, menos que PIPE_BUF, así que se escribe completo o no se escribe
+    int escrito = writev(c->fd, iov, c->numPendientes) != -1;
+    if (!escrito && (errno == EPIPE || errno == EBADF)) {
+        //El pipe guardado ya no tiene lector, pero puede haber uno nuevo con el mismo nombre (el pid se reutilizó
+        //o se reprodujo otra vez una traza), así que se abre de nuevo y se reintenta una vez
+        close(c->fd);
+        c->fd = abrirPipeRespuesta(c->pid);
+        escrito = c->fd >= 0 && writev(c->fd, iov, c->numPendientes) != -1;
+    }
+    if (escrito) {
+        respuestasEnviadas += c->numPendientes;
+        c->numPendientes = 0;
+        c->lleno = 0;
+    } else if (c->fd >= 0 && errno == EAGAIN) {
+        //El pipe está lleno porque el solicitante no lo está leyendo. Las respuestas son de operaciones ya
+        //aplicadas, así que se dejan en cola y se reintentan en el siguiente envío
+        if (!c->lleno) {
+            printf("Pipe pipe_%d lleno, sus respuestas quedan en espera\n", c->pid);
+            c->lleno = 1;
+        }
+    } else {
+        if (c->fd >= 0) {
+            printf("Error al escribir en el pipe pipe_%d\n", c->pid);
+            //El solicitante ya no está, se cierra el pipe para abrirlo de nuevo si vuelve a escribir
+            close(c->fd);
+            c->fd = -1;
+        }
+        c->numPendientes = 0;
+    }
+}
 
-    // Escrube el mensaje en el pipe y manda error en caso de no poder enviarlo
-    if (write(fd, mensaje, strlen(mensaje) + 1) == -1) {
-        printf("Error al escribir en el pipe %s\n", pipe2);
+// Envía las respuestas acumuladas. Con forzar se envían todas (fin de un lote de operaciones),
+// si no solo las de los solicitantes cuya respuesta más antigua ya esperó LATENCIA_SALIDA_MS
+void vaciarRespuestas(int forzar) {
+    long long ahora = tiempoMs();
+    pthread_mutex_lock(&mutexClientes);
+    for (int i = 0; i < MAX_CLIENTES; i++) {
+        struct Cliente *c = &clientes[i];
+        if (c->numPendientes > 0 && (forzar || ahora - c->primeraPendiente >= LATENCIA_SALIDA_MS)) {
+            vaciarCliente(c);
+        }
     }
+    pthread_mutex_unlock(&mutexClientes);
+}
 
-    close(fd);
+// Envía lo pendiente y cierra los pipes de respuesta de todos los solicitantes
+void cerrarClientes() {
+    pthread_mutex_lock(&mutexClientes);
+    for (int i = 0; i < MAX_CLIENTES; i++) {
+        struct Cliente *c = &clientes[i];
+        if (c->pid != 0 && c->fd >= 0) {
+            vaciarCliente(c);
+            respuestasDescartadas += c->numPendientes;
+            close(c->fd);
+            c->fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&mutexClientes);
 }
 
-// Lee una operación enviada por el solicitante a través del pipe principal
-int leerPipe(int fd, struct Operaciones *op, int verbose) {
-    //Char que guardara la respuesta
-    char buffer[256];
-    //Lee los datos del pipe
-    int bytes = read(fd, buffer, sizeof(buffer) - 1);
-    // No hay datos o fin 
-    if (bytes <= 0) {
-        return 0;
-    } 
+// Deja una respuesta en la cola de salida del solicitante. Se envía al vaciar las respuestas
+// al final del lote, o antes si la cola se llena
+void enviarRespuesta(int pid, const char *mensaje) {
+    trazaRespuesta(pid, mensaje);
+    //El pipe se abre fuera del mutex porque puede tardar; solo la primera vez que se le responde al solicitante
+    pthread_mutex_lock(&mutexClientes);
+    struct Cliente *c = buscarCliente(pid, 1);
+    int abrir = c && c->fd < 0;
+    pthread_mutex_unlock(&mutexClientes);
+    int fd = abrir ? abrirPipeRespuesta(pid) : -1;
+    if (abrir && fd < 0) {
+        return;
+    }
 
-    buffer[bytes] = '\0';
+    pthread_mutex_lock(&mutexClientes);
+    c = buscarCliente(pid, 1);
+    if (c && c->fd < 0) {
+        c->fd = fd;
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    if (!c || c->fd < 0) {
+        //No hay espacio en la tabla de solicitantes, se escribe directamente en un pipe temporal
+        pthread_mutex_unlock(&mutexClientes);
+        fd = abrirPipeRespuesta(pid);
+        if (fd >= 0) {
+            if (write(fd, mensaje, strlen(mensaje) + 1) == -1) {
+                printf("Error al escribir en el pipe pipe_%d\n", pid);
+            }
+            close(fd);
+        }
+        return;
+    }
+    if (c->numPendientes == MAX_RESP_PENDIENTES) {
+        vaciarCliente(c);
+    }
+    //Si el solicitante sigue sin leer y ya tiene el máximo de respuestas en espera, la nueva se descarta
+    if (c->numPendientes == MAX_RESP_PENDIENTES) {
+        respuestasDescartadas++;
+        pthread_mutex_unlock(&mutexClientes);
+        return;
+    }
+    if (c->numPendientes == 0) {
+        c->primeraPendiente = tiempoMs();
+    }
+    c->largo[c->numPendientes] = snprintf(c->respuestas[c->numPendientes], sizeof(c->respuestas[0]), "%s", mensaje);
+    if (c->largo[c->numPendientes] >= (int)sizeof(c->respuestas[0])) {
+        c->largo[c->numPendientes] = sizeof(c->respuestas[0]) - 1;
+    }
+    c->numPendientes++;
+    pthread_mutex_unlock(&mutexClientes);
+}
+
+// Lee una operación enviada por el solicitante a través del pipe principal.
+// Varios solicitantes escriben en el mismo pipe, así que una lectura puede traer más de un mensaje
+// o solo una parte; lo que sobra se guarda para la siguiente llamada
+int leerPipe(int fd, struct Operaciones *op, int verbose) {
+    //Bytes recibidos que aún no se han procesado
+    static char pendiente[512];
+    static int pendienteLen = 0;
+    //Se lee del pipe solo si no hay ya un mensaje completo pendiente
+    while (memchr(pendiente, '\0', pendienteLen) == NULL) {
+        //Antes de bloquearse esperando datos se envían las respuestas dadas desde este hilo
+        vaciarRespuestas(1);
+        //Si el mensaje no cabe se descarta, ningún mensaje válido es tan largo
+        if (pendienteLen == sizeof(pendiente)) {
+            printf("Mensaje demasiado largo descartado\n");
+            pendienteLen = 0;
+        }
+        int bytes = read(fd, pendiente + pendienteLen, sizeof(pendiente) - pendienteLen);
+        // No hay datos o fin
+        if (bytes <= 0) {
+            return 0;
+        }
+        pendienteLen += bytes;
+    }
 
-        //Valida el formato en el que se recibió la operación
-    if (sscanf(buffer, "%c,%249[^,],%d,%d", &op->tipo, op->nombre, &op->isbn, &op->pid) != 4) {
-        printf("Formato inválido recibido: %s\n", buffer);
+        //Valida el formato del primer mensaje completo, el plazo en ms y la sucursal son opcionales
+    char nombre[250];
+    char sucursalStr[64];
+    int plazo = PLAZO_DEFECTO_MS;
+    int campos = sscanf(pendiente, "%c,%249[^,],%d,%d,%d,%63[^,]", &op->tipo, nombre, &op->isbn, &op->pid, &plazo, sucursalStr);
+    //La sucursal llega por nombre (como en -f) o por su posición en -f; -1 si no existe
+    op->sucursal = 0;
+    if (campos == 6) {
+        op->sucursal = sucursalStr[strspn(sucursalStr, "0123456789")] == '\0' ? atoi(sucursalStr) : buscarSucursal(sucursalStr);
+    }
+    if (campos < 4) {
+        printf("Formato inválido recibido: %s\n", pendiente);
+    }
+    //Se corre lo que sobra al inicio para la siguiente llamada
+    int largo = strlen(pendiente) + 1;
+    memmove(pendiente, pendiente + largo, pendienteLen - largo);
+    pendienteLen -= largo;
+    if (campos < 4) {
         return 0;
     }
+    op->llegada = tiempoMs();
+    op->limite = plazo > 0 ? op->llegada + plazo : 0;
+    //El título se resuelve aquí una sola vez, de ahí en adelante la operación solo lleva su id.
+    //En las consultas V el nombre es la fecha de corte
+    op->idNombre = buscarNombre(&nombres, nombre);
+    int dia, mes, anio;
+    op->fecha = op->tipo == 'V' && sscanf(nombre, "%d-%d-%d", &dia, &mes, &anio) == 3 ? fechaOrdinal(nombre) : 0;
+
+    trazaOperacion(op, nombre, plazo);
 
     //Se imprime lo que se recibió en caso de haber activado verbose
     if (verbose) {
-        printf("Recibido: tipo = %c, nombre = %s, isbn = %d, pid = %d\n", op->tipo, op->nombre, op->isbn, op->pid);
+        printf("Recibido: tipo = %c, nombre = %s, isbn = %d, pid = %d, sucursal = %d\n", op->tipo, nombre, op->isbn, op->pid, op->sucursal);
     }
 
-    // Se añade al buffer y se marca para terminar los hilos en caso de ser Q
+    // Se marca para terminar los hilos en caso de ser Q, que terminan al vaciar el buffer
     if (op->tipo == 'Q') {
-        anadirBuffer(op);
+        pthread_mutex_lock(&mutex);
         terminar = 1;
+        pthread_cond_broadcast(&cond_no_vacio);
+        pthread_mutex_unlock(&mutex);
         return 0;
         // Se retorna 1 en caso de ser devolución o renovación
     } else if (op->tipo == 'D' || op->tipo == 'R') {
@@ -197,44 +1137,69 @@ int leerPipe(int fd, struct Operaciones *op, int verbose) {
         //Se retorna 2 en caso de ser préstamo
     } else if (op->tipo == 'P') {
         return 2;
+        //Se retorna 3 en caso de ser consulta de vencidos
+    } else if (op->tipo == 'V') {
+        return 3;
     }
 
     return 0;
 }
 
-// Procesa las operaciones de devolución y renovación que esten en el buffer
+// Procesa las operaciones de préstamo, devolución y renovación en el orden que decide el planificador
 void *auxiliar1(void *args) {
-    // Se leen los argumentos pasados desde la creación del hilo
-    struct Libros *libros = (struct Libros *)((void **)args)[0];
-    int numLibros = *(int *)((void **)args)[1];
-
     //While que no tiene condición, se detiene si se usa un break
     while (1) {
+        //Se envían las respuestas que agotaron su tiempo de espera; el resto sale al terminar el lote en leerBuffer
+        vaciarRespuestas(0);
     //Se lee una operación del buffer
         struct Operaciones op = leerBuffer();
         //Si el tipo es q, se sale del while
         if (op.tipo == 'Q') {
             break;
         }
+        //Si ya se venció el plazo se descarta sin procesarla, y se le avisa al solicitante para que no siga esperando
+        if (op.limite && tiempoMs() > op.limite) {
+            printf("Operación %c expirada descartada: ISBN %d, pid %d\n", op.tipo, op.isbn, op.pid);
+            char respuesta[256];
+            snprintf(respuesta, sizeof(respuesta), "Error: operación %c expirada sin procesar: ISBN %d", op.tipo, op.isbn);
+            enviarRespuesta(op.pid, respuesta);
+            liberar(op.pid);
+            continue;
+        }
+        //Se bloquea la sucursal mientras se modifica el ejemplar y el heap de vencimientos,
+        //y se toma la versión publicada de su catálogo. Las demás sucursales siguen disponibles
+        //para los otros hilos trabajadores
+        struct Sucursal *suc = &sucursales[op.sucursal];
+        pthread_mutex_lock(&suc->mutex);
+        struct Catalogo *cat = suc->catalogo;
+        //Los préstamos tienen su propio procedimiento
+        if (op.tipo == 'P') {
+            prestamoProceso(&op, cat);
+            pthread_mutex_unlock(&suc->mutex);
+            liberar(op.pid);
+            continue;
+        }
         //Ciclo que recorre el el número de libros que hay en la base de datos
-        for (int i = 0; i < numLibros; i++) {
+        for (int i = 0; i < cat->numLibros; i++) {
             //Se verifica si el isbn y el nombre de libro de la operación es el mismo al libro actual
-            if (libros[i].isbn == op.isbn && strcmp(libros[i].nombre, op.nombre) == 0) {
+            if (cat->isbn[i] == op.isbn && cat->idNombre[i] == op.idNombre) {
                 // entero que sirve para saber si se encontro el ejemplar buscado
                 int encontrado = 0;
                 // Ciclo que recorre los ejemplares del libro encontrado
-                for (int j = 0; j < libros[i].numEj; j++) {
+                for (int j = 0; j < cat->numEj[i]; j++) {
                     // Se pregunta si el status del libro es prestado
-                    if (libros[i].ejemplares[j].status == 'P' && !encontrado) {
+                    if (cat->ejemplares[i][j].status == 'P' && !encontrado) {
                         // Condicional en caso de que el tipo de la op sea devolución
                         if (op.tipo == 'D') {
                             //Se cambia el status a devuelto
-                            libros[i].ejemplares[j].status = 'D';
+                            cat->ejemplares[i][j].status = 'D';
+                            heapQuitar(cat, i, j);
+                            cat->version++;
                             //Se notifica en pantalla
-                            printf("Devolución realizada del libro: ISBN %d, Ejemplar %d\n", op.isbn, libros[i].ejemplares[j].numero);
+                            printf("Devolución realizada del libro: ISBN %d, Ejemplar %d\n", op.isbn, cat->ejemplares[i][j].numero);
                             //Se envía la respuesta al proceso solicitante y se marca como encontrado el libro
                             char respuesta[256];
-                            snprintf(respuesta, sizeof(respuesta), "Devolución exitosa: ISBN %d, Ejemplar %d", op.isbn, libros[i].ejemplares[j].numero);
+                            snprintf(respuesta, sizeof(respuesta), "Devolución exitosa: ISBN %d, Ejemplar %d", op.isbn, cat->ejemplares[i][j].numero);
                             enviarRespuesta(op.pid, respuesta);
                             encontrado = 1;
                             break;
@@ -242,7 +1207,7 @@ void *auxiliar1(void *args) {
                         } else if (op.tipo == 'R') {
                             // Se guarda las fechas en variables distintas para asegurar correctamente el cambio de fecha
                             char dia[3], mes[3], anio[5];
-                            sscanf(libros[i].ejemplares[j].fecha, "%2s-%2s-%4s", dia, mes, anio);
+                            sscanf(cat->ejemplares[i][j].fecha, "%2s-%2s-%4s", dia, mes, anio);
                             int d = atoi(dia);
                             //se añaden 7 días
                             d += 7;
@@ -264,10 +1229,12 @@ void *auxiliar1(void *args) {
                             mes[2] = '\0';
                             anio[4] = '\0';
                             //Se guarda el cambio en la fecha del ejemplar y se manda la respuesta al proceso solicitante
-                            snprintf(libros[i].ejemplares[j].fecha, 11, "%2s-%2s-%4s", dia, mes, anio);
-                            printf("Renovación procesada: ISBN %d, Ejemplar %d, Nueva fecha: %s\n", op.isbn, libros[i].ejemplares[j].numero, libros[i].ejemplares[j].fecha);
+                            snprintf(cat->ejemplares[i][j].fecha, 11, "%2s-%2s-%4s", dia, mes, anio);
+                            heapActualizar(cat, i, j);
+                            cat->version++;
+                            printf("Renovación procesada: ISBN %d, Ejemplar %d, Nueva fecha: %s\n", op.isbn, cat->ejemplares[i][j].numero, cat->ejemplares[i][j].fecha);
                             char respuesta[256];
-                            snprintf(respuesta, sizeof(respuesta), "Renovación exitosa: ISBN %d, Ejemplar %d", op.isbn, libros[i].ejemplares[j].numero);
+                            snprintf(respuesta, sizeof(respuesta), "Renovación exitosa: ISBN %d, Ejemplar %d", op.isbn, cat->ejemplares[i][j].numero);
                             enviarRespuesta(op.pid, respuesta);
                             encontrado = 1;
                             break;
@@ -284,35 +1251,49 @@ void *auxiliar1(void *args) {
                 break;
             }
             //Condicional en caso de no encontrar un libro válidp, se envía mensaje de error
-            if (i == numLibros - 1) {
+            if (i == cat->numLibros - 1) {
                 char respuesta[256];
                 snprintf(respuesta, sizeof(respuesta), "Error: ISBN %d no encontrado o nombre erróneo", op.isbn);
                 enviarRespuesta(op.pid, respuesta);
                 printf("ISBN %d no encontrado\n", op.isbn);
             } 
         }
+        pthread_mutex_unlock(&suc->mutex);
+        //Ya se respondió, la operación deja de contar como en curso
+        liberar(op.pid);
     }
     return NULL;
 }
 
-//Maneja comandos interactivos del usuario (s para salir, r para generar reporte)
+//Maneja comandos interactivos del usuario (s para salir, r para generar reporte, e para tiempos de espera, v para vencidos,
+//c y a para recargar el catálogo completo o agregar un delta)
 void *auxiliar2(void *args) {
-    // Se leen los argumentos pasados desde la creación del hilo
-    struct Libros *libros = (struct Libros *)((void **)args)[0];
-    int numLibros = *(int *)((void **)args)[1];
-    //Se guarda el comando en este char
+    //Se guarda el comando en este char y lo que siga en la línea en resto
     char comando[3];
+    char resto[256];
 
     //While que no tiene condición, se detiene si se usa un break
     while (1) {
         //Se válida que no se use mas de un caracter en los comandos
-        if (scanf("%2s", comando) != 1) {
-            while (getchar() != '\n'); // Limpia el buffer de entrada
-            printf("Entrada inválida, utilice 's' para salir o 'r' para reporte\n");
+        int leidos = scanf("%2s", comando);
+        //Si se cerró la entrada no llegarán más comandos, el receptor termina cuando llegue Q
+        if (leidos == EOF) {
+            break;
+        }
+        if (leidos != 1) {
+            int ch;
+            while ((ch = getchar()) != '\n' && ch != EOF); // Limpia el buffer de entrada
+            printf("Entrada inválida, utilice 's' para salir, 'r' para reporte, 'e' para tiempos de espera, 'v' para vencidos o 'c'/'a' para recargar\n");
             continue;
         }
-        //// Limpia el buffer después de leer
-        while (getchar() != '\n');
+        //Se guardan los argumentos del comando y se limpia el buffer después de leer
+        if (!fgets(resto, sizeof(resto), stdin)) {
+            resto[0] = '\0';
+        } else if (!strchr(resto, '\n')) {
+            //Si la última línea no termina en salto de línea se para en EOF
+            int ch;
+            while ((ch = getchar()) != '\n' && ch != EOF);
+        }
         //En caso de que se pida salir
         if (strcmp(comando, "s") == 0) {
             // Bloquea el mutex para modificar terminar
@@ -327,41 +1308,94 @@ void *auxiliar2(void *args) {
             //En caso de que el comando sea de reporte
         } else if (strcmp(comando, "r") == 0) {
             printf("Reporte:\n");
-            // Bloquea para acceso seguro a libros
-            pthread_mutex_lock(&mutex);
-            //Se imprimen los ejemplares
-            for (int i = 0; i < numLibros; i++) {
-                for (int j = 0; j < libros[i].numEj; j++) {
-                    printf("%c, %s, %d, %d, %s\n", libros[i].ejemplares[j].status, libros[i].nombre, libros[i].isbn, libros[i].ejemplares[j].numero, libros[i].ejemplares[j].fecha);
+            for (int s = 0; s < numSucursales; s++) {
+                // Bloquea para acceso seguro a los libros de la sucursal
+                pthread_mutex_lock(&sucursales[s].mutex);
+                struct Catalogo *cat = sucursales[s].catalogo;
+                if (numSucursales > 1) {
+                    printf("Sucursal %s:\n", sucursales[s].nombre);
                 }
+                //Se imprimen los ejemplares
+                for (int i = 0; i < cat->numLibros; i++) {
+                    for (int j = 0; j < cat->numEj[i]; j++) {
+                        printf("%c, %s, %d, %d, %s%s\n", cat->ejemplares[i][j].status, nombreDe(&nombres, cat->idNombre[i]), cat->isbn[i], cat->ejemplares[i][j].numero,
+                               cat->ejemplares[i][j].fecha, cat->ejemplares[i][j].vencido ? " (vencido)" : "");
+                    }
+                }
+                pthread_mutex_unlock(&sucursales[s].mutex);
+            }
+            //En caso de que se pidan los tiempos de espera del planificador
+        } else if (strcmp(comando, "e") == 0) {
+            reporteEspera();
+            //En caso de que se pidan los vencidos: 'v' lista todos a hoy, 'v k' los k más atrasados
+            //y 'v dd-mm-aaaa' todos los vencidos a esa fecha
+        } else if (strcmp(comando, "v") == 0) {
+            int fecha = fechaHoy(), k = 0;
+            int dia, mes, anio;
+            if (sscanf(resto, "%d-%d-%d", &dia, &mes, &anio) == 3) {
+                fecha = fechaOrdinal(resto);
+            } else if (sscanf(resto, "%d", &k) != 1) {
+                k = 0;
+            }
+            struct Vencimiento res[MAX_LIBROS * MAX_EJEMPLAR];
+            char fechaStr[11];
+            ordinalFecha(fecha, fechaStr);
+            for (int s = 0; s < numSucursales; s++) {
+                pthread_mutex_lock(&sucursales[s].mutex);
+                struct Catalogo *cat = sucursales[s].catalogo;
+                int total = listarVencidos(cat, fecha, k, res);
+                if (numSucursales > 1) {
+                    printf("Sucursal %s, vencidos al %s: %d\n", sucursales[s].nombre, fechaStr, total);
+                } else {
+                    printf("Vencidos al %s: %d\n", fechaStr, total);
+                }
+                for (int i = 0; i < total; i++) {
+                    int l = res[i].libro;
+                    char fechaEj[11];
+                    ordinalFecha(res[i].fecha, fechaEj);
+                    printf("%s, %d, %d, %s\n", nombreDe(&nombres, cat->idNombre[l]), cat->isbn[l], cat->ejemplares[l][res[i].ejemplar].numero, fechaEj);
+                }
+                pthread_mutex_unlock(&sucursales[s].mutex);
+            }
+            //En caso de que se pida recargar el catálogo: 'c archivo [sucursal]' lo reemplaza y 'a archivo [sucursal]'
+            //solo agrega. Sin sucursal se recarga la primera
+        } else if (strcmp(comando, "c") == 0 || strcmp(comando, "a") == 0) {
+            char archivo[256], nombreSuc[64];
+            int campos = sscanf(resto, "%255s %63s", archivo, nombreSuc);
+            int s = campos == 2 ? buscarSucursal(nombreSuc) : 0;
+            if (campos < 1) {
+                printf("Indique el archivo del catálogo, por ejemplo: %s basedatos.txt [sucursal]\n", comando);
+            } else if (s < 0) {
+                printf("La sucursal %s no existe\n", nombreSuc);
+            } else if (iniciarRecarga(s, archivo, comando[0] == 'c') == 0) {
+                printf("Ya hay una recarga del catálogo de %s en curso\n", sucursales[s].nombre);
             }
-            pthread_mutex_unlock(&mutex);
         } else {
-            //Verificacion en caso de no ser r o s lo que se digita
-            printf("Utilice solo 's' o 'r' si quiere acabar la ejecución o ver un reporte\n");
+            //Verificacion en caso de no ser un comando válido lo que se digita
+            printf("Utilice solo 's', 'r', 'e', 'v', 'c' o 'a' si quiere acabar la ejecución, ver un reporte, los tiempos de espera, los vencidos o recargar el catálogo\n");
         }
     }
     return NULL;
 }
 
 // Procesa una operación de préstamo, actualizando el estado de un ejemplar disponible.
-void prestamoProceso(struct Operaciones *op, struct Libros *libros, int numLibros) {
+void prestamoProceso(struct Operaciones *op, struct Catalogo *cat) {
     //Para validar de que se encuentre el libro
     int libroEncontrado = 0;
     //Ciclo que recorre los libros
-    for (int i = 0; i < numLibros; i++) {
+    for (int i = 0; i < cat->numLibros; i++) {
         //Se verifica si el isbn y el nombre de libro de la operación es el mismo al libro actual
-        if (libros[i].isbn == op->isbn && strcmp(libros[i].nombre, op->nombre) == 0) {
+        if (cat->isbn[i] == op->isbn && cat->idNombre[i] == op->idNombre) {
             //Marca que encontro el libro y hay otra validación por si se encontró ejemplar que no este prestado
             libroEncontrado = 1;
             int encontrado = 0;
             //Ciclo que recorre todos los ejemplares del libro
-            for (int j = 0; j < libros[i].numEj; j++) {
+            for (int j = 0; j < cat->numEj[i]; j++) {
                 //Si encuentra uno no prestado, cambia el status a prestado y aumenta la fecha, de igual manera que en las renovaciones
-                if (libros[i].ejemplares[j].status == 'D') {
-                    libros[i].ejemplares[j].status = 'P';
+                if (cat->ejemplares[i][j].status == 'D') {
+                    cat->ejemplares[i][j].status = 'P';
                     char dia[3], mes[3], anio[5];
-                    sscanf(libros[i].ejemplares[j].fecha, "%2s-%2s-%4s", dia, mes, anio);
+                    sscanf(cat->ejemplares[i][j].fecha, "%2s-%2s-%4s", dia, mes, anio);
                     int d = atoi(dia);
                     d += 7;
                     if (d > 30) {
@@ -376,11 +1410,13 @@ void prestamoProceso(struct Operaciones *op, struct Libros *libros, int numLibro
                     dia[2] = '\0';
                     mes[2] = '\0';
                     anio[4] = '\0';
-                    snprintf(libros[i].ejemplares[j].fecha, 11, "%2s-%2s-%4s", dia, mes, anio);
+                    snprintf(cat->ejemplares[i][j].fecha, 11, "%2s-%2s-%4s", dia, mes, anio);
+                    heapActualizar(cat, i, j);
+                    cat->version++;
                     //Avisa que se realizó el préstamo y envia respuesta al proceso solicitante
-                    printf("Préstamo realizado del libro: ISBN %d, Ejemplar %d\n", op->isbn, libros[i].ejemplares[j].numero);
+                    printf("Préstamo realizado del libro: ISBN %d, Ejemplar %d\n", op->isbn, cat->ejemplares[i][j].numero);
                     char respuesta[256];
-                    snprintf(respuesta, sizeof(respuesta), "Préstamo exitoso: ISBN %d, Ejemplar %d", op->isbn, libros[i].ejemplares[j].numero);
+                    snprintf(respuesta, sizeof(respuesta), "Préstamo exitoso: ISBN %d, Ejemplar %d", op->isbn, cat->ejemplares[i][j].numero);
                     enviarRespuesta(op->pid, respuesta);
                     encontrado = 1;
                     return;
@@ -405,8 +1441,18 @@ void prestamoProceso(struct Operaciones *op, struct Libros *libros, int numLibro
     }
 }
 
+// Escribe todos los libros y ejemplares con el mismo formato de la base de datos
+void escribirSalida(FILE *salida, struct Catalogo *cat) {
+    for (int i = 0; i < cat->numLibros; i++) {
+        fprintf(salida, "%s,%d,%d\n", nombreDe(&nombres, cat->idNombre[i]), cat->isbn[i], cat->numEj[i]);
+        for (int j = 0; j < cat->numEj[i]; j++) {
+            fprintf(salida, "%d,%c,%s\n", cat->ejemplares[i][j].numero, cat->ejemplares[i][j].status, cat->ejemplares[i][j].fecha);
+        }
+    }
+}
+
 // Guarda el estado final de la base de datos en un archivo de salida
-void guardarSalida(char *fileSalida, struct Libros *libros, int numLibros) {
+void guardarSalida(char *fileSalida, struct Catalogo *cat) {
     //Abre el archivo en modo escritura
     FILE *salida = fopen(fileSalida, "w");
     //si hay error se le notifica al usuario
@@ -415,49 +1461,69 @@ void guardarSalida(char *fileSalida, struct Libros *libros, int numLibros) {
         return;
     }
     // Guarda todos los libros y ejemplares en el archivo con el mismo formato de la base de datos
-    for (int i = 0; i < numLibros; i++) {
-        fprintf(salida, "%s,%d,%d\n", libros[i].nombre, libros[i].isbn, libros[i].numEj);
-        for (int j = 0; j < libros[i].numEj; j++) {
-            fprintf(salida, "%d,%c,%s\n", libros[i].ejemplares[j].numero, libros[i].ejemplares[j].status, libros[i].ejemplares[j].fecha);
-        }
-    }
+    escribirSalida(salida, cat);
     //Se cierra el archivo
     fclose(salida);
 }
 
+// Hilo que guarda el estado final de una sucursal en su archivo de salida
+void *guardarSucursal(void *args) {
+    struct Sucursal *suc = (struct Sucursal *)args;
+    guardarSalida(suc->fileSalida, suc->catalogo);
+    return NULL;
+}
+
 
 // Proceso principal. Inicializa los recursos, crea hilos, y procesa operaciones
 int main(int argc, char *argv[]) {
     //Se verifica que se pase la cantidad de argumentos válida, de lo contrario se sale del programa
-    if (argc != 5 && argc != 6 && argc != 7 && argc != 8) {
-        printf("\n \t\tUse: $./receptor –p pipeReceptor –f filedatos [-v] [–s filesalida]\n");
+    if (argc < 5) {
+        printf("\n \t\tUse: $./receptor –p pipeReceptor –f [sucursal=]filedatos [-f ...] [-v] [–s filesalida] [-c ordenPrioridad] [-g filetraza] [-w hilos]\n");
         exit(1);
     }
 
     //Variables por si toca guardar datos según lo que se pase de argumento
     char *pipeRec = NULL;
-    char *nomArchivo = NULL;
     int verbose = 0;
     char *fileSalida = NULL;
-    //Arreglo de libros
-    struct Libros libros[MAX_LIBROS];
+    char *orden = ORDEN_DEFECTO;
+    char *fileTraza = NULL;
+    int numTrabajadores = 1;
 
-        //Recorre los argumentos y revisa que banderas hay y cuales no, guardando la información respectiva
+        //Recorre los argumentos y revisa que banderas hay y cuales no, guardando la información respectiva.
+        //Cada -f agrega una sucursal
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
             pipeRec = argv[++i];
         } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
-            nomArchivo = argv[++i];
+            if (!agregarSucursal(argv[++i])) {
+                exit(1);
+            }
         } else if (strcmp(argv[i], "-v") == 0) {
             verbose = 1;
         } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
             fileSalida = argv[++i];
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            orden = argv[++i];
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+            fileTraza = argv[++i];
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            numTrabajadores = atoi(argv[++i]);
         }
     }
 
-    //Se cierra el programa en caso de no haber ni nombre de pipe ni nombre del archivo de la base de datos
-    if (!pipeRec || !nomArchivo) {
-        printf("\n \t\tUse: $./receptor –p pipeReceptor –f filedatos [-v] [–s filesalida]\n");
+    //Se cierra el programa en caso de no haber ni nombre de pipe ni ninguna base de datos
+    if (!pipeRec || numSucursales == 0) {
+        printf("\n \t\tUse: $./receptor –p pipeReceptor –f [sucursal=]filedatos [-f ...] [-v] [–s filesalida] [-c ordenPrioridad] [-g filetraza] [-w hilos]\n");
+        exit(1);
+    }
+    if (numTrabajadores < 1 || numTrabajadores > MAX_TRABAJADORES) {
+        printf("El número de hilos debe estar entre 1 y %d\n", MAX_TRABAJADORES);
+        exit(1);
+    }
+    //Se verifica que el orden de prioridad incluya cada tipo de operación una sola vez
+    if (!configurarClases(orden)) {
+        printf("Orden de prioridad inválido %s, debe ser una permutación de D, P y R\n", orden);
         exit(1);
     }
 
@@ -472,10 +1538,30 @@ int main(int argc, char *argv[]) {
         printf("Error al abrir el pipe %s\n", pipeRec);
         exit(1);
     }
-    // Se lee la base de datos y se verifica que se haya leído exitosamente
-    int numLibros = leerDB(nomArchivo, libros);
-    if (numLibros <= 0 || numLibros > MAX_LIBROS) {
-        printf("Error cargando la base de datos\n");
+    // Se leen las bases de datos de todas las sucursales en paralelo y se verifica que se hayan leído exitosamente
+    diaActual = fechaHoy();
+    pthread_t hilosCarga[MAX_SUCURSALES];
+    for (int s = 0; s < numSucursales; s++) {
+        pthread_create(&hilosCarga[s], NULL, cargarSucursal, &sucursales[s]);
+    }
+    int fallos = 0;
+    for (int s = 0; s < numSucursales; s++) {
+        void *resultado;
+        pthread_join(hilosCarga[s], &resultado);
+        fallos += resultado != NULL;
+        if (verbose && resultado == NULL) {
+            printf("Sucursal %d: %s (%s)\n", s, sucursales[s].nombre, sucursales[s].archivo);
+        }
+    }
+    if (fallos > 0) {
+        close(fd);
+        unlink(pipeRec);
+        exit(1);
+    }
+
+    //Si se pidió, se empieza a grabar la traza de operaciones y respuestas
+    if (fileTraza && !abrirTraza(fileTraza)) {
+        printf("Error al crear el archivo de traza %s\n", fileTraza);
         close(fd);
         unlink(pipeRec);
         exit(1);
@@ -483,12 +1569,25 @@ int main(int argc, char *argv[]) {
 
     //Se inicializa el mutex, se asigna memoria para los libros y se crea args para llevarlo a los métodos de los hilos
     pthread_mutex_init(&mutex, NULL);
-    pthread_t hiloAux1, hiloAux2;
-    void *args[2] = {libros, &numLibros};
+    pthread_t hilosAux1[MAX_TRABAJADORES], hiloAux2, hiloVencidos;
+    pthread_t hiloSenales;
 
-    // Se crean los hilos
-    pthread_create(&hiloAux1, NULL, auxiliar1, args);
-    pthread_create(&hiloAux2, NULL, auxiliar2, args);
+    //Si un solicitante termina sin leer su pipe, writev falla con EPIPE en lugar de terminar el proceso
+    signal(SIGPIPE, SIG_IGN);
+    //SIGHUP se atiende solo en el hilo de señales, así que se bloquea antes de crear los demás hilos
+    sigset_t senales;
+    sigemptyset(&senales);
+    sigaddset(&senales, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &senales, NULL);
+    pthread_create(&hiloSenales, NULL, auxiliarSenales, NULL);
+    pthread_detach(hiloSenales);
+
+    // Se crean los hilos, con tantos trabajadores para las operaciones como se pidieron
+    for (int t = 0; t < numTrabajadores; t++) {
+        pthread_create(&hilosAux1[t], NULL, auxiliar1, NULL);
+    }
+    pthread_create(&hiloAux2, NULL, auxiliar2, NULL);
+    pthread_create(&hiloVencidos, NULL, auxiliarVencidos, NULL);
 
         //While encargado de leer el pipe y definir que hacer con lo que se lea
     struct Operaciones op;
@@ -500,23 +1599,88 @@ int main(int argc, char *argv[]) {
             pthread_cond_broadcast(&cond_no_vacio);
             break;
         }
-        //resultado es igual a 1, se añade la operación al buffer
-        if (resultado == 1) { // Operaciones D o R
-            anadirBuffer(&op);
-            //Si es 2, se llama directamente a prestamoProceso para manejar la operación
-        } else if (resultado == 2) { // Operación P
-            prestamoProceso(&op, libros, numLibros);
+        //Las operaciones para una sucursal que no existe se rechazan de inmediato
+        if (resultado != 0 && (op.sucursal < 0 || op.sucursal >= numSucursales)) {
+            char respuesta[256];
+            if (op.sucursal < 0) {
+                snprintf(respuesta, sizeof(respuesta), "Error: la sucursal indicada no existe");
+            } else {
+                snprintf(respuesta, sizeof(respuesta), "Error: sucursal %d no existe", op.sucursal);
+            }
+            enviarRespuesta(op.pid, respuesta);
+            continue;
+        }
+        //Las operaciones D, R y P se añaden al planificador si hay capacidad,
+        //si no se responde de inmediato que está ocupado para no bloquear la lectura del pipe
+        if (resultado == 1 || resultado == 2) {
+            int esperaMs;
+            if (admitir(&op, &esperaMs)) {
+                anadirBuffer(&op);
+            } else {
+                char respuesta[256];
+                snprintf(respuesta, sizeof(respuesta), "Ocupado: reintente en %d ms", esperaMs);
+                enviarRespuesta(op.pid, respuesta);
+                if (verbose) {
+                    printf("Operación %c rechazada por sobrecarga: pid %d\n", op.tipo, op.pid);
+                }
+            }
+            //Las consultas de vencidos solo leen el heap, se responden de inmediato
+        } else if (resultado == 3) {
+            consultaVencidos(&op);
         }
     }
 
     //Se esperan a los hilos a que acabem y se cierra el pipe
-    pthread_join(hiloAux1, NULL);
+    for (int t = 0; t < numTrabajadores; t++) {
+        pthread_join(hilosAux1[t], NULL);
+    }
     pthread_join(hiloAux2, NULL);
+    pthread_join(hiloVencidos, NULL);
     close(fd);
+    //Se envían las respuestas que falten y se cierran los pipes de los solicitantes
+    cerrarClientes();
+    //Se dejan de aceptar recargas (el hilo de señales sigue vivo) y, si hay recargas en curso,
+    //se espera a que publiquen antes de guardar el estado final
+    pthread_mutex_lock(&mutexRecarga);
+    recargasCerradas = 1;
+    for (int s = 0; s < numSucursales; s++) {
+        while (sucursales[s].recargando) {
+            pthread_cond_wait(&condRecarga, &mutexRecarga);
+        }
+    }
+    pthread_mutex_unlock(&mutexRecarga);
+    if (verbose) {
+        reporteEspera();
+    }
 
-    //Si se marco que se quiere el archivo de salida, se llama al método respectivo
+    //Si se marco que se quiere el archivo de salida, se guarda cada sucursal en paralelo. Con una sola sucursal
+    //se usa el nombre tal cual, con varias se agrega el de la sucursal antes de la extensión
     if (fileSalida) {
-        guardarSalida(fileSalida, libros, numLibros);
+        pthread_t hilosSalida[MAX_SUCURSALES];
+        const char *punto = strrchr(fileSalida, '.');
+        if (!punto || strchr(punto, '/')) {
+            punto = fileSalida + strlen(fileSalida);
+        }
+        for (int s = 0; s < numSucursales; s++) {
+            struct Sucursal *suc = &sucursales[s];
+            char nombreSuc[64];
+            strcpy(nombreSuc, suc->nombre);
+            if (numSucursales == 1) {
+                snprintf(suc->fileSalida, sizeof(suc->fileSalida), "%s", fileSalida);
+            } else {
+                snprintf(suc->fileSalida, sizeof(suc->fileSalida), "%.*s_%s%s", (int)(punto - fileSalida), fileSalida, nombreSuc, punto);
+            }
+            pthread_create(&hilosSalida[s], NULL, guardarSucursal, suc);
+        }
+        for (int s = 0; s < numSucursales; s++) {
+            pthread_join(hilosSalida[s], NULL);
+        }
+    }
+    //La traza termina con el estado final para poder compararlo al reproducirla
+    cerrarTraza();
+    for (int s = 0; s < numSucursales; s++) {
+        free(sucursales[s].catalogo);
+        pthread_mutex_destroy(&sucursales[s].mutex);
     }
     //Se destruye el mutex y se elimina el archivo del pipe
     pthread_mutex_destroy(&mutex);
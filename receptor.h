@@ -14,45 +14,205 @@
 
 #define MAX_EJEMPLAR 10
 #define MAX_LIBROS 100
+// Máximo de sucursales (bases de datos) por receptor y de hilos que procesan operaciones
+#define MAX_SUCURSALES 8
+#define MAX_TRABAJADORES 8
 #define BUFFER_TAM 10
+// Límites de admisión: operaciones en curso por solicitante y en total
+#define MAX_CLIENTES 32
+#define MAX_POR_CLIENTE 2
+#define MAX_EN_VUELO BUFFER_TAM
+// Clases de prioridad del planificador (una por tipo de operación) y orden por defecto
+#define NUM_CLASES 3
+#define ORDEN_DEFECTO "DPR"
+// Operaciones que atiende cada clase, en orden de prioridad, por cada ronda en que todas tienen pendientes.
+// La primera clase sigue yendo primero, pero las demás tienen garantizada una parte del hilo
+#define PESOS_CLASES {4, 2, 1}
+// Segundos entre revisiones del hilo que marca ejemplares vencidos
+#define REVISION_VENCIDOS 1
+// Milisegundos sugeridos al solicitante por cada operación en curso cuando el receptor está ocupado
+#define REINTENTO_MS 50
+// Intentos de publicar una recarga combinada fuera del mutex antes de combinarla con el mutex tomado
+#define INTENTOS_RECARGA 2
+// Respuestas que se acumulan por solicitante antes de enviarlas juntas, y máximo de ms que pueden esperar
+#define MAX_RESP_PENDIENTES 8
+#define LATENCIA_SALIDA_MS 2
+// Plazo usado cuando el solicitante no envía uno propio
+#define PLAZO_DEFECTO_MS 1000
+// Capacidad del pool de títulos: cantidad de nombres, bytes y tamaño de la tabla hash (potencia de 2).
+// Cada título ocupa hasta 250 bytes, así que caben MAX_NOMBRES títulos de largo máximo. El pool es compartido,
+// así que alcanza para todas las sucursales llenas con títulos distintos, y otro tanto para recargas
+#define MAX_NOMBRES (2 * MAX_SUCURSALES * MAX_LIBROS)
+#define TAM_POOL (MAX_NOMBRES * 250)
+#define TAM_TABLA_NOMBRES 4096
+// Formato del archivo de traza (debe coincidir con reproductor.h): encabezado y tipos de registro
+#define MAGIA_TRAZA "TRZ2"
+#define TRAZA_OPERACION 'O'
+#define TRAZA_RESPUESTA 'A'
+#define TRAZA_ESTADO 'S'
 
 //Representa un ejemplar de un libro con su número, estado y fecha
 struct Ejemplar {
     int numero;
     char status;
     char fecha[11];
+    char vencido; // Marcado por el hilo de vencimientos cuando pasa la fecha de un ejemplar prestado
 };
 
-// Representa un libro con su ISBN, nombre y arreglo de ejemplares
-struct Libros {
+// Representa una operación enviada por el solicitante. El título llega como texto por el pipe
+// pero se resuelve una sola vez a su id en el pool de nombres
+struct Operaciones {
+    char tipo;
+    int idNombre; // -1 si el título no existe en el catálogo
     int isbn;
-    char nombre[250];
-    int numEj;
-    struct Ejemplar ejemplares[MAX_EJEMPLAR];
+    int pid;
+    int fecha; // Solo para consultas V: fecha de corte en días, 0 para usar la de hoy
+    int sucursal; // Índice de la sucursal a la que va la operación (0 si el solicitante no la indica, -1 si no existe)
+    long long limite; // Instante (ms, reloj monotónico) después del cual la operación se descarta
+    long long llegada; // Instante (ms) en que se leyó del pipe, para medir la espera en cola
 };
 
-// Representa una operación enviada por el solicitante
-struct Operaciones {
+// Cola FIFO con las operaciones pendientes de un solicitante dentro de una clase
+struct ColaCliente {
+    int pid;
+    int inicio;
+    int cont;
+    struct Operaciones ops[MAX_POR_CLIENTE];
+};
+
+// Clase de prioridad: agrupa las operaciones de un tipo y atiende a los solicitantes por turnos
+struct ClasePrioridad {
     char tipo;
-    char nombre[250];
-    int isbn;
+    int turno;
+    int peso;    // Operaciones que puede atender por ronda
+    int credito; // Operaciones que le quedan en la ronda actual
+    struct ColaCliente colas[MAX_CLIENTES];
+    // Estadísticas de espera en cola
+    long atendidas;
+    long long esperaTotalMs;
+    long long esperaMaxMs;
+};
+
+// Estado de cada solicitante conocido: operaciones en curso, su pipe de respuesta (que se deja abierto)
+// y las respuestas que esperan a enviarse juntas con writev. pid 0 indica una entrada libre
+struct Cliente {
     int pid;
+    int enCurso;
+    int fd;
+    int numPendientes;
+    int lleno; // Indica si ya se avisó que su pipe está lleno, para no repetir el aviso en cada lote
+    long long primeraPendiente; // Instante (ms) en que se encoló la respuesta más antigua sin enviar
+    int largo[MAX_RESP_PENDIENTES];
+    char respuestas[MAX_RESP_PENDIENTES][256];
+};
+
+// Ejemplar prestado dentro del heap de vencimientos
+struct Vencimiento {
+    int fecha; // Fecha de entrega en días (meses de 30 días, como al sumar días en préstamos)
+    int libro;
+    int ejemplar;
+};
+
+// Min-heap indexado de ejemplares prestados ordenado por fecha de entrega.
+// posicion guarda el índice de cada ejemplar dentro de nodos, o -1 si no está prestado
+struct HeapVencimientos {
+    int cont;
+    struct Vencimiento nodos[MAX_LIBROS * MAX_EJEMPLAR];
+    int posicion[MAX_LIBROS][MAX_EJEMPLAR];
+};
+
+// Títulos internados: cada nombre distinto se guarda una sola vez y se identifica por su id.
+// tabla es una tabla hash de direccionamiento abierto que guarda id + 1 (0 es una casilla libre)
+struct PoolNombres {
+    int cont;
+    int usado;
+    int inicio[MAX_NOMBRES];
+    unsigned hash[MAX_NOMBRES];
+    int tabla[TAM_TABLA_NOMBRES];
+    char datos[TAM_POOL];
+};
+
+// Catálogo de libros separado en arreglos: los campos que se recorren en cada operación
+// (isbn, id del título, ejemplares) quedan contiguos y los títulos viven en el pool de nombres
+struct Catalogo {
+    unsigned version; // Aumenta con cada préstamo, devolución o renovación que cambia un ejemplar
+    int numLibros;
+    int isbn[MAX_LIBROS];
+    int idNombre[MAX_LIBROS];
+    int numEj[MAX_LIBROS];
+    struct Ejemplar ejemplares[MAX_LIBROS][MAX_EJEMPLAR];
+    struct HeapVencimientos vencimientos;
+};
+
+// Sucursal de la biblioteca: cada una tiene su base de datos, su catálogo y su propio mutex.
+// El catálogo solo se lee o reemplaza con ese mutex tomado, así que una versión vieja se puede liberar
+// en cuanto se publica la nueva
+struct Sucursal {
+    char nombre[64];
+    char archivo[256];
+    struct Catalogo *catalogo;
+    pthread_mutex_t mutex;
+    int recargando; // Indica si hay una recarga en curso (solo se permite una a la vez por sucursal)
+    char fileSalida[512]; // Archivo donde se guarda su estado final
+};
+
+// Pedido de recarga del catálogo de una sucursal: archivo a leer y si reemplaza el catálogo (completo) o solo agrega (delta)
+struct Recarga {
+    int sucursal;
+    char archivo[256];
+    int completo;
 };
 
 // Variables compartidas
-extern struct Operaciones buffer[BUFFER_TAM];
+extern struct ClasePrioridad clases[NUM_CLASES];
 extern int bufferCont;
 extern int terminar;
+extern int enVuelo;
+extern struct PoolNombres nombres;
+extern struct Sucursal sucursales[MAX_SUCURSALES];
+extern int numSucursales;
 
 // Funciones del receptor
-int leerDB(char *nomArchivo, struct Libros *libros);
+int internarNombre(struct PoolNombres *pool, const char *nombre);
+int buscarNombre(struct PoolNombres *pool, const char *nombre);
+const char *nombreDe(struct PoolNombres *pool, int id);
+int leerDB(char *nomArchivo, struct Catalogo *cat);
+void combinarCatalogo(struct Catalogo *nuevo, struct Catalogo *leido, struct Catalogo *actual, int completo);
+int agregarSucursal(const char *arg);
+int buscarSucursal(const char *nombre);
+void *cargarSucursal(void *args);
+int iniciarRecarga(int sucursal, const char *archivo, int completo);
+void *auxiliarRecarga(void *args);
+void *auxiliarSenales(void *args);
+long long tiempoMs();
+int admitir(struct Operaciones *op, int *esperaMs);
+void liberar(int pid);
+int configurarClases(const char *orden);
 void anadirBuffer(struct Operaciones *op);
 struct Operaciones leerBuffer();
+void reporteEspera();
+int fechaOrdinal(const char *fecha);
+void ordinalFecha(int ordinal, char *fecha);
+int fechaHoy();
+void heapIniciar(struct Catalogo *cat);
+void heapActualizar(struct Catalogo *cat, int libro, int ejemplar);
+void heapQuitar(struct Catalogo *cat, int libro, int ejemplar);
+int listarVencidos(struct Catalogo *cat, int fecha, int k, struct Vencimiento *res);
+void consultaVencidos(struct Operaciones *op);
+void *auxiliarVencidos(void *args);
+int abrirTraza(const char *archivo);
+void trazaOperacion(struct Operaciones *op, const char *nombre, int plazo);
+void trazaRespuesta(int pid, const char *mensaje);
+void cerrarTraza();
 void enviarRespuesta(int pid, const char *mensaje);
+void vaciarRespuestas(int forzar);
+void cerrarClientes();
 int leerPipe(int fd, struct Operaciones *op, int verbose);
 void *auxiliar1(void *args);
 void *auxiliar2(void *args);
-void prestamoProceso(struct Operaciones *op, struct Libros *libros, int numLibros);
-void guardarSalida(char *fileSalida, struct Libros *libros, int numLibros);
+void prestamoProceso(struct Operaciones *op, struct Catalogo *cat);
+void escribirSalida(FILE *salida, struct Catalogo *cat);
+void guardarSalida(char *fileSalida, struct Catalogo *cat);
+void *guardarSucursal(void *args);
 
 #endif
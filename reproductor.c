@@ -0,0 +1,400 @@
+/**************************************************************
+#         		Pontificia Universidad Javeriana
+#     Autor: Carlos Daniel Guiza
+#     Fecha: 15 de Mayo de 2025
+#     Materia: Sistemas Operativos
+#     Tema: Proyecto - Sistema para el prestamo de libros
+#     Fichero: reproductor.c
+#	Descripcion: Reproduce contra un receptor una traza grabada con la opción -g del receptor.
+                Envía las operaciones con el ritmo original o tan rápido como se pueda, mide
+                el rendimiento y la latencia, y compara respuestas y estado final con la grabación
+#****************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include "reproductor.h"
+
+// Operaciones y respuestas leídas de la traza
+struct OpTraza *ops = NULL;
+int numOps = 0;
+struct RespTraza *resps = NULL;
+int numResps = 0;
+// Enlaza cada respuesta con la siguiente de la misma operación (-1 si es la última)
+int *siguienteResp = NULL;
+// Estado final grabado por el receptor (NULL si la traza no lo tiene)
+char *estado = NULL;
+// Pipes de respuesta, uno por solicitante de la traza
+struct PipePid pipes[MAX_PIDS];
+int numPipes = 0;
+
+// Devuelve el tiempo actual en microsegundos según el reloj monotónico
+static long long ahoraUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Busca el pipe de un solicitante, o NULL si no está
+static struct PipePid *pipeDe(int pid) {
+    for (int i = 0; i < numPipes; i++) {
+        if (pipes[i].pid == pid) {
+            return &pipes[i];
+        }
+    }
+    return NULL;
+}
+
+// Lee toda la traza en memoria y asocia cada respuesta con la última operación de su solicitante.
+// Devuelve 0 si el archivo no existe o no es una traza
+int leerTraza(char *nomArchivo) {
+    FILE *archivo = fopen(nomArchivo, "rb");
+    if (!archivo) {
+        printf("Error al abrir la traza %s\n", nomArchivo);
+        return 0;
+    }
+    char magia[4];
+    if (fread(magia, 1, 4, archivo) != 4 || memcmp(magia, MAGIA_TRAZA, 4) != 0) {
+        printf("El archivo %s no es una traza del receptor\n", nomArchivo);
+        fclose(archivo);
+        return 0;
+    }
+    int capOps = 0, capResps = 0;
+    //Última operación leída de cada solicitante, para asociarle sus respuestas
+    int ultimaOp[MAX_PIDS], pidsVistos[MAX_PIDS], numPids = 0;
+    char tipoReg;
+    long long t;
+    while (fread(&tipoReg, 1, 1, archivo) == 1 && fread(&t, sizeof(t), 1, archivo) == 1) {
+        if (tipoReg == TRAZA_OPERACION) {
+            if (numOps == capOps) {
+                capOps = capOps ? capOps * 2 : 64;
+                ops = realloc(ops, capOps * sizeof(struct OpTraza));
+            }
+            struct OpTraza *op = &ops[numOps];
+            unsigned char largo;
+            fread(&op->tipo, 1, 1, archivo);
+            fread(&op->isbn, sizeof(int), 1, archivo);
+            fread(&op->pid, sizeof(int), 1, archivo);
+            fread(&op->plazo, sizeof(int), 1, archivo);
+            fread(&op->sucursal, sizeof(int), 1, archivo);
+            fread(&largo, 1, 1, archivo);
+            if (fread(op->nombre, 1, largo, archivo) != largo) break;
+            op->nombre[largo] = '\0';
+            op->t = t;
+            op->primeraResp = -1;
+            op->numResp = 0;
+            //Se registra el solicitante si es nuevo
+            int k = 0;
+            while (k < numPids && pidsVistos[k] != op->pid) k++;
+            if (k == numPids) {
+                if (numPids == MAX_PIDS) {
+                    printf("La traza tiene más de %d solicitantes\n", MAX_PIDS);
+                    fclose(archivo);
+                    return 0;
+                }
+                pidsVistos[numPids++] = op->pid;
+            }
+            ultimaOp[k] = numOps++;
+        } else if (tipoReg == TRAZA_RESPUESTA) {
+            if (numResps == capResps) {
+                capResps = capResps ? capResps * 2 : 64;
+                resps = realloc(resps, capResps * sizeof(struct RespTraza));
+                siguienteResp = realloc(siguienteResp, capResps * sizeof(int));
+            }
+            struct RespTraza *r = &resps[numResps];
+            unsigned short largo;
+            fread(&r->pid, sizeof(int), 1, archivo);
+            fread(&largo, sizeof(largo), 1, archivo);
+            r->mensaje = malloc(largo + 1);
+            if (fread(r->mensaje, 1, largo, archivo) != largo) break;
+            r->mensaje[largo] = '\0';
+            r->t = t;
+            siguienteResp[numResps] = -1;
+            //La respuesta se agrega al final de la lista de la última operación de ese solicitante
+            int k = 0;
+            while (k < numPids && pidsVistos[k] != r->pid) k++;
+            if (k == numPids) {
+                free(r->mensaje);
+                continue;
+            }
+            struct OpTraza *op = &ops[ultimaOp[k]];
+            if (op->primeraResp < 0) {
+                op->primeraResp = numResps;
+            } else {
+                int j = op->primeraResp;
+                while (siguienteResp[j] >= 0) j = siguienteResp[j];
+                siguienteResp[j] = numResps;
+            }
+            op->numResp++;
+            numResps++;
+        } else if (tipoReg == TRAZA_ESTADO) {
+            unsigned largo;
+            fread(&largo, sizeof(largo), 1, archivo);
+            estado = malloc(largo + 1);
+            if (fread(estado, 1, largo, archivo) != largo) break;
+            estado[largo] = '\0';
+        } else {
+            printf("Registro desconocido en la traza: %c\n", tipoReg);
+            break;
+        }
+    }
+    fclose(archivo);
+    printf("Traza leída: %d operaciones, %d respuestas, %d solicitantes\n", numOps, numResps, numPids);
+    return numOps > 0;
+}
+
+// Crea y abre un pipe de respuesta por cada solicitante de la traza, con el mismo pid que en la grabación
+int abrirPipes() {
+    for (int i = 0; i < numOps; i++) {
+        if (pipeDe(ops[i].pid)) {
+            continue;
+        }
+        struct PipePid *p = &pipes[numPipes];
+        char nombre[20];
+        snprintf(nombre, sizeof(nombre), "pipe_%d", ops[i].pid);
+        if (mkfifo(nombre, 0666) == -1 && errno != EEXIST) {
+            printf("Error al crear el pipe de respuesta %s\n", nombre);
+            return 0;
+        }
+        //Abierto en ambos sentidos para que no llegue EOF, y sin bloqueo para usar poll
+        p->fd = open(nombre, O_RDWR | O_NONBLOCK);
+        if (p->fd < 0) {
+            printf("Error al abrir el pipe de respuesta %s\n", nombre);
+            unlink(nombre);
+            return 0;
+        }
+        p->pid = ops[i].pid;
+        p->pendienteLen = 0;
+        numPipes++;
+    }
+    return 1;
+}
+
+// Espera hasta timeoutMs un mensaje completo en el pipe de un solicitante.
+// Devuelve 1 y copia el mensaje en respuesta, o 0 si no llegó a tiempo
+int esperarRespuesta(struct PipePid *p, char *respuesta, int tam, int timeoutMs) {
+    long long limite = ahoraUs() + (long long)timeoutMs * 1000;
+    while (memchr(p->pendiente, '\0', p->pendienteLen) == NULL) {
+        int restante = (limite - ahoraUs()) / 1000;
+        if (restante < 0) restante = 0;
+        struct pollfd pfd = {p->fd, POLLIN, 0};
+        if (poll(&pfd, 1, restante) <= 0) {
+            return 0;
+        }
+        int bytes = read(p->fd, p->pendiente + p->pendienteLen, sizeof(p->pendiente) - p->pendienteLen);
+        if (bytes <= 0) {
+            return 0;
+        }
+        p->pendienteLen += bytes;
+        //Si el mensaje no cabe se descarta
+        if (p->pendienteLen == sizeof(p->pendiente) && !memchr(p->pendiente, '\0', p->pendienteLen)) {
+            p->pendienteLen = 0;
+        }
+    }
+    int largo = strlen(p->pendiente) + 1;
+    snprintf(respuesta, tam, "%s", p->pendiente);
+    memmove(p->pendiente, p->pendiente + largo, p->pendienteLen - largo);
+    p->pendienteLen -= largo;
+    return 1;
+}
+
+// Compara dos enteros largos, para ordenar las latencias
+static int compararLatencias(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Indica si el receptor grabado aplicó la operación. Un préstamo, devolución o renovación que solo recibió
+// "Ocupado" o "expirada", o ninguna respuesta, no cambió el catálogo; reenviarla la aplicaría dos veces
+// junto con el reintento del solicitante
+int operacionAplicada(struct OpTraza *op) {
+    if (op->tipo != 'P' && op->tipo != 'D' && op->tipo != 'R') {
+        return 1;
+    }
+    for (int r = op->primeraResp; r >= 0; r = siguienteResp[r]) {
+        if (strncmp(resps[r].mensaje, "Ocupado:", 8) != 0 && !strstr(resps[r].mensaje, "expirada")) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Envía las operaciones de la traza en orden, una a la vez, esperando las respuestas que tuvo cada una
+// en la grabación. Con rapido se envían sin pausa, si no se respeta el instante original de cada una
+void reproducir(int fd, int rapido) {
+    long long *latencias = malloc(numOps * sizeof(long long));
+    int numLat = 0, distintas = 0, perdidas = 0, inesperadas = 0, omitidas = 0;
+    char respuesta[512];
+    long long inicio = ahoraUs();
+    //Los instantes se miden desde la primera operación, no desde que arrancó el receptor grabado
+    long long primera = numOps > 0 ? ops[0].t : 0;
+
+    for (int i = 0; i < numOps; i++) {
+        struct OpTraza *op = &ops[i];
+        struct PipePid *p = pipeDe(op->pid);
+        //Las operaciones que el receptor grabado no aplicó no se reenvían, su reintento ya está en la traza
+        if (!operacionAplicada(op)) {
+            omitidas++;
+            continue;
+        }
+        //Con el ritmo original se espera hasta el instante en que llegó la operación
+        if (!rapido) {
+            long long espera = inicio + (op->t - primera) - ahoraUs();
+            if (espera > 0) usleep(espera);
+        }
+        //Lo que haya quedado en el pipe no corresponde a esta operación
+        while (esperarRespuesta(p, respuesta, sizeof(respuesta), 0)) {
+            inesperadas++;
+        }
+        char mensaje[300];
+        snprintf(mensaje, sizeof(mensaje), "%c,%s,%d,%d,%d,%d", op->tipo, op->nombre, op->isbn, op->pid, op->plazo, op->sucursal);
+        long long t0 = ahoraUs();
+        if (write(fd, mensaje, strlen(mensaje) + 1) == -1) {
+            printf("Error al escribir en el pipe del receptor\n");
+            break;
+        }
+        //Se comparan las respuestas con las grabadas, en el mismo orden
+        for (int r = op->primeraResp; r >= 0; r = siguienteResp[r]) {
+            if (!esperarRespuesta(p, respuesta, sizeof(respuesta), ESPERA_RESPUESTA_MS)) {
+                perdidas++;
+                printf("Sin respuesta para la operación %d (%c, ISBN %d); se esperaba: %s\n", i, op->tipo, op->isbn, resps[r].mensaje);
+                break;
+            }
+            if (r == op->primeraResp) {
+                latencias[numLat++] = ahoraUs() - t0;
+            }
+            if (strcmp(respuesta, resps[r].mensaje) != 0) {
+                distintas++;
+                printf("Respuesta distinta en la operación %d (%c, ISBN %d)\n  grabada:    %s\n  reproducida: %s\n",
+                       i, op->tipo, op->isbn, resps[r].mensaje, respuesta);
+            }
+        }
+    }
+    long long total = ahoraUs() - inicio;
+
+    //Resumen de rendimiento y latencia
+    int enviadas = numOps - omitidas;
+    printf("Operaciones enviadas: %d en %.3f s (%.1f ops/s), %d omitidas por no haberse aplicado\n", enviadas, total / 1e6,
+           total > 0 ? enviadas * 1e6 / total : 0.0, omitidas);
+    if (numLat > 0) {
+        qsort(latencias, numLat, sizeof(long long), compararLatencias);
+        long long suma = 0;
+        for (int i = 0; i < numLat; i++) suma += latencias[i];
+        printf("Latencia (us): promedio %lld, p50 %lld, p99 %lld, máxima %lld\n", suma / numLat, latencias[numLat / 2],
+               latencias[(numLat * 99) / 100 < numLat ? (numLat * 99) / 100 : numLat - 1], latencias[numLat - 1]);
+    }
+    printf("Respuestas: %d distintas, %d sin llegar, %d inesperadas\n", distintas, perdidas, inesperadas);
+    free(latencias);
+}
+
+// Espera a que el receptor termine (borra su pipe al salir) y compara sus archivos de salida, uno por sucursal
+// y en el mismo orden de -f, con el estado grabado
+void compararEstado(const char *pipeRec, char **salidas, int numSalidas) {
+    if (!estado) {
+        printf("La traza no tiene estado final para comparar\n");
+        return;
+    }
+    for (int espera = 0; access(pipeRec, F_OK) == 0 && espera < ESPERA_CIERRE_MS; espera += 10) {
+        usleep(10000);
+    }
+    //Se comparan línea por línea las salidas del receptor, una tras otra, y el estado grabado
+    char linea[512];
+    const char *esperado = estado;
+    int numLinea = 0, diferencias = 0;
+    for (int s = 0; s < numSalidas; s++) {
+        FILE *archivo = fopen(salidas[s], "r");
+        if (!archivo) {
+            printf("Error al abrir el archivo de salida %s\n", salidas[s]);
+            return;
+        }
+        while (fgets(linea, sizeof(linea), archivo)) {
+            numLinea++;
+            int largo = strcspn(esperado, "\n");
+            linea[strcspn(linea, "\n")] = '\0';
+            if ((int)strlen(linea) != largo || strncmp(linea, esperado, largo) != 0) {
+                diferencias++;
+                printf("Línea %d distinta\n  grabada:    %.*s\n  reproducida: %s\n", numLinea, largo, esperado, linea);
+            }
+            esperado += largo;
+            if (*esperado == '\n') esperado++;
+        }
+        fclose(archivo);
+    }
+    if (*esperado != '\0') {
+        diferencias++;
+        printf("A la salida reproducida le faltan líneas a partir de la %d\n", numLinea + 1);
+    }
+    if (diferencias == 0) {
+        printf("Estado final idéntico al de la ejecución grabada\n");
+    } else {
+        printf("Estado final con %d diferencias\n", diferencias);
+    }
+}
+
+// Función principal del reproductor. Lee la traza, la reproduce y compara el resultado
+int main(int argc, char *argv[]) {
+    //Se verifica el número de argumentos pasados, para ver si es válido o no
+    if (argc < 5) {
+        printf("\n\tUse: $./reproductor -p pipeReceptor -t filetraza [-r] [-s filesalida [-s ...]]\n");
+        exit(1);
+    }
+    //Variables por si toca guardar datos según lo que se pase de argumento
+    char *pipeRec = NULL;
+    char *nomTraza = NULL;
+    char *salidas[MAX_SALIDAS];
+    int numSalidas = 0;
+    int rapido = 0;
+
+    //Recorre los argumentos y revisa que banderas hay y cuales no, guardando la información respectiva
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pipeRec = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            nomTraza = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && numSalidas < MAX_SALIDAS) {
+            //Con varias sucursales se pasa un -s por cada archivo de salida
+            salidas[numSalidas++] = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0) {
+            rapido = 1;
+        }
+    }
+    if (!pipeRec || !nomTraza) {
+        printf("\n\tUse: $./reproductor -p pipeReceptor -t filetraza [-r] [-s filesalida [-s ...]]\n");
+        exit(1);
+    }
+
+    if (!leerTraza(nomTraza)) {
+        exit(1);
+    }
+    // Se intenta abrir el pipe del receptor en modo escritura
+    int fd = open(pipeRec, O_WRONLY);
+    if (fd < 0) {
+        printf("Error al abrir el pipe %s\n", pipeRec);
+        exit(1);
+    }
+    int pipesAbiertos = abrirPipes();
+    if (pipesAbiertos) {
+        reproducir(fd, rapido);
+    }
+    close(fd);
+
+    //Se compara el estado final si se indicó dónde lo guarda el receptor
+    if (pipesAbiertos && numSalidas > 0) {
+        compararEstado(pipeRec, salidas, numSalidas);
+    }
+
+    //Se cierran y eliminan los pipes de respuesta
+    for (int i = 0; i < numPipes; i++) {
+        char nombre[20];
+        snprintf(nombre, sizeof(nombre), "pipe_%d", pipes[i].pid);
+        close(pipes[i].fd);
+        unlink(nombre);
+    }
+    return pipesAbiertos ? 0 : 1;
+}
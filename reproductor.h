@@ -0,0 +1,65 @@
+/**************************************************************
+#         		Pontificia Universidad Javeriana
+#     Autor: Carlos Daniel Guiza
+#     Fecha: 15 de Mayo de 2025
+#     Materia: Sistemas Operativos
+#     Tema: Proyecto - Sistema para el prestamo de libros
+#     Fichero: reproductor.h
+#	Descripcion: Archivo de encabezado para reproductor.c.
+#                Define el formato de la traza grabada por el receptor y los prototipos de funciones del reproductor
+#****************************************************************/
+
+#ifndef REPRODUCTOR_H
+#define REPRODUCTOR_H
+
+// Formato del archivo de traza (debe coincidir con receptor.h): encabezado y tipos de registro
+#define MAGIA_TRAZA "TRZ2"
+#define TRAZA_OPERACION 'O'
+#define TRAZA_RESPUESTA 'A'
+#define TRAZA_ESTADO 'S'
+
+// Máximo de solicitantes distintos en una traza
+#define MAX_PIDS 64
+// Tiempo máximo (ms) que se espera cada respuesta y el cierre del receptor
+#define ESPERA_RESPUESTA_MS 2000
+#define ESPERA_CIERRE_MS 10000
+// Máximo de archivos de salida (uno por sucursal) que se comparan con el estado grabado
+#define MAX_SALIDAS 8
+
+// Operación grabada en la traza, junto con las respuestas que recibió en la ejecución original
+struct OpTraza {
+    long long t;    // Microsegundos desde el inicio de la traza
+    char tipo;
+    char nombre[256];
+    int isbn;
+    int pid;
+    int plazo;
+    int sucursal;
+    int primeraResp; // Índice de su primera respuesta en el arreglo de respuestas
+    int numResp;
+};
+
+// Respuesta grabada en la traza
+struct RespTraza {
+    long long t;
+    int pid;
+    char *mensaje;
+};
+
+// Pipe de respuesta creado para un solicitante de la traza y los bytes recibidos sin procesar
+struct PipePid {
+    int pid;
+    int fd;
+    char pendiente[512];
+    int pendienteLen;
+};
+
+// Funciones del reproductor
+int leerTraza(char *nomArchivo);
+int abrirPipes();
+int esperarRespuesta(struct PipePid *p, char *respuesta, int tam, int timeoutMs);
+int operacionAplicada(struct OpTraza *op);
+void reproducir(int fd, int rapido);
+void compararEstado(const char *pipeRec, char **salidas, int numSalidas);
+
+#endif
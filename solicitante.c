@@ -17,36 +17,125 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include "solicitante.h"
 
-// Función para leer respuestas del pipe (usada por ambas funciones)
-void leerRespuesta(int fdResp, const char *pipeRecibe, char tipo, int isbn) {
-    //Char para almacenar la respuesta junto al total de intentos para abrir el pipe
-    char respuesta[256];
-    int intentos = 10;
-    int total_bytes = 0;
-
-    //Da 10 intentos al pipe para abrirse
-    while (intentos-- > 0) {
-        //Se lee el pipe de respuesta y se imprime lo recibido
-        int bytes = read(fdResp, respuesta + total_bytes, sizeof(respuesta) - 1 - total_bytes);
-        if (bytes > 0) {
-            total_bytes += bytes;
-            if (respuesta[total_bytes - 1] == '\0') { // Mensaje completo recibido
-                printf("Respuesta del receptor para operación %c, ISBN %d: %s\n", tipo, isbn, respuesta);
-                return;
+// Sucursal a la que van todas las operaciones: su nombre en el receptor o su posición en -f
+const char *sucursal = "0";
+
+// Bytes leídos del pipe de respuesta que todavía no forman un mensaje completo. Un read puede traer
+// parte de una respuesta o varias juntas, así que lo que sobra se guarda para la siguiente lectura
+char pendiente[512];
+int pendienteLen = 0;
+
+// Milisegundos de un reloj monotónico, para medir plazos sin que los afecten cambios de hora
+long long tiempoMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Abre el pipe del receptor sin bloquearse. Si el receptor todavía no lo creó o no lo ha abierto se reintenta,
+// duplicando la espera entre intentos hasta CONEXION_MAX_MS. Devuelve el descriptor o -1
+int conectarReceptor(const char *pipeRec) {
+    long long limite = tiempoMs() + ESPERA_CONEXION_MS;
+    int esperaMs = CONEXION_INICIAL_MS;
+    while (1) {
+        int fd = open(pipeRec, O_WRONLY | O_NONBLOCK);
+        if (fd >= 0) {
+            //Ya conectado, las escrituras vuelven a ser bloqueantes para esperar si el pipe se llena
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        }
+        //ENOENT: el pipe no existe aún, ENXIO: existe pero nadie lo está leyendo
+        if ((errno != ENOENT && errno != ENXIO) || tiempoMs() + esperaMs > limite) {
+            return -1;
+        }
+        usleep(esperaMs * 1000);
+        esperaMs = esperaMs * 2 > CONEXION_MAX_MS ? CONEXION_MAX_MS : esperaMs * 2;
+    }
+}
+
+// Descarta las respuestas que llegaron tarde a operaciones anteriores, para no confundirlas con la siguiente
+void descartarRespuestas(int fdResp) {
+    char basura[256];
+    while (read(fdResp, basura, sizeof(basura)) > 0);
+    pendienteLen = 0;
+}
+
+// Función para leer respuestas del pipe (usada por ambas funciones). Espera con poll hasta que llegue
+// un mensaje completo o se agote ESPERA_RESPUESTA_MS, así la respuesta se procesa apenas llega.
+// Devuelve los ms que se deben esperar antes de reintentar si el receptor está ocupado, o 0 en otro caso
+int leerRespuesta(int fdResp, const char *pipeRecibe, char tipo, int isbn) {
+    long long limite = tiempoMs() + ESPERA_RESPUESTA_MS;
+    while (1) {
+        //Si ya hay un mensaje completo se procesa y se corre lo que sobra al inicio
+        char *fin = memchr(pendiente, '\0', pendienteLen);
+        if (fin) {
+            char respuesta[512];
+            int largo = fin - pendiente + 1;
+            memcpy(respuesta, pendiente, largo);
+            memmove(pendiente, pendiente + largo, pendienteLen - largo);
+            pendienteLen -= largo;
+            printf("Respuesta del receptor para operación %c, ISBN %d: %s\n", tipo, isbn, respuesta);
+            //El receptor indica cuánto esperar si rechazó la operación por sobrecarga
+            int esperaMs;
+            if (sscanf(respuesta, "Ocupado: reintente en %d ms", &esperaMs) == 1 && esperaMs > 0) {
+                return esperaMs;
             }
+            return 0;
+        }
+        //Si el mensaje no cabe se descarta, ninguna respuesta válida es tan larga
+        if (pendienteLen == sizeof(pendiente)) {
+            printf("Respuesta demasiado larga descartada\n");
+            pendienteLen = 0;
+        }
+        int restante = limite - tiempoMs();
+        if (restante <= 0) {
+            printf("No se recibió respuesta para la operación %c, ISBN %d en %d ms\n", tipo, isbn, ESPERA_RESPUESTA_MS);
+            return 0;
+        }
+        //Se espera a que haya datos sin pasarse del plazo de esta operación
+        struct pollfd pfd = {fdResp, POLLIN, 0};
+        int listos = poll(&pfd, 1, restante);
+        if (listos < 0 && errno != EINTR) {
+            printf("Error al esperar el pipe de respuesta \n");
+            return 0;
+        }
+        if (listos <= 0) {
+            continue;
+        }
+        int bytes = read(fdResp, pendiente + pendienteLen, sizeof(pendiente) - pendienteLen);
+        if (bytes > 0) {
+            pendienteLen += bytes;
         } else if (bytes == 0) {
             // Fin (pipe cerrado por el otro extremo)
             printf("El pipe de respuesta %s fue cerrado por el receptor\n", pipeRecibe);
-            return;
-        } else {
+            return 0;
+        } else if (errno != EAGAIN && errno != EINTR) {
             printf("Error al leer el pipe de respuesta \n");
+            return 0;
+        }
+    }
+}
+
+// Envía una operación al receptor y espera su respuesta, reintentando si el receptor está ocupado
+void enviarOperacion(int fd, pid_t pid, const char *pipeRecibe, int fdResp, struct Operaciones *op) {
+    char mensaje[300];
+    //Se incluye el plazo para que el receptor descarte la operación si ya no se va a esperar su respuesta,
+    //y la sucursal que tiene el libro
+    snprintf(mensaje, sizeof(mensaje), "%c,%s,%d,%d,%d,%s", op->tipo, op->nombre, op->isbn, pid, PLAZO_MS, sucursal);
+    for (int intento = 0; intento <= MAX_REINTENTOS; intento++) {
+        descartarRespuestas(fdResp);
+        write(fd, mensaje, strlen(mensaje) + 1);
+        int esperaMs = leerRespuesta(fdResp, pipeRecibe, op->tipo, op->isbn);
+        if (esperaMs == 0) {
             return;
         }
-        usleep(100000); // Esperar 100ms antes de reintentar
+        usleep(esperaMs * 1000);
     }
-    printf("No se recibió respuesta para la operación %c, ISBN %d después de varios intentos\n", tipo, isbn);
+    printf("El receptor sigue ocupado, se abandona la operación %c, ISBN %d\n", op->tipo, op->isbn);
 }
 
 // Lee operaciones desde un archivo de texto y las envía al receptor
@@ -79,11 +168,8 @@ void leerArchivo(char *nomArchivo, int fd, pid_t pid, const char *pipeRecibe, in
                 write(fd, mensaje, strlen(mensaje) + 1);
                 break;
             }
-            //Se escribe el mensaje en el pipe y se llama a leer respuesta para esperar la respuesta de receptor
-            char mensaje[256];
-            snprintf(mensaje, sizeof(mensaje), "%c,%s,%d,%d", op.tipo, op.nombre, op.isbn, pid);
-            write(fd, mensaje, strlen(mensaje) + 1);
-            leerRespuesta(fdResp, pipeRecibe, op.tipo, op.isbn);
+            //Se escribe el mensaje en el pipe y se espera la respuesta de receptor
+            enviarOperacion(fd, pid, pipeRecibe, fdResp, &op);
 
         } else {
             printf("Error al leer la línea: %s\n", linea);
@@ -117,28 +203,25 @@ void menu(int fd, pid_t pid, const char *pipeRecibe, int fdResp) {
     while (continuar) {
         //Pedir al usuario que digite la información de la operación
         struct Operaciones op;
-        printf("Operación (D/R/P): ");
+        printf("Operación (D/R/P, o V para consultar vencidos): ");
         scanf(" %c", &op.tipo);
 
-        printf("Nombre del libro: ");
+        printf(op.tipo == 'V' ? "Fecha de corte (dd-mm-aaaa, o Hoy): " : "Nombre del libro: ");
         scanf(" %249[^\n]", op.nombre);
         while (getchar() != '\n');
 
-        printf("ISBN: ");
+        printf(op.tipo == 'V' ? "Cantidad a listar (0 para todos): " : "ISBN: ");
         scanf("%d", &op.isbn);
         while (getchar() != '\n');
 
-            //Se verifica que la operación que se haya digitado sea una de las 3 disponibles, de lo contrario se vuelve a preguntar
-        if (op.tipo != 'D' && op.tipo != 'R' && op.tipo != 'P') {
-            printf("Operación inválida. Debe ser D, R o P.\n");
+            //Se verifica que la operación que se haya digitado sea una de las 4 disponibles, de lo contrario se vuelve a preguntar
+        if (op.tipo != 'D' && op.tipo != 'R' && op.tipo != 'P' && op.tipo != 'V') {
+            printf("Operación inválida. Debe ser D, R, P o V.\n");
             continue;
         }
 
-        //Se manda el mensaje en el pipe y se llama a leer respuesta del receptor
-        char mensaje[256];
-        snprintf(mensaje, sizeof(mensaje), "%c,%s,%d,%d", op.tipo, op.nombre, op.isbn, pid);
-        write(fd, mensaje, strlen(mensaje) + 1);
-        leerRespuesta(fdResp, pipeRecibe, op.tipo, op.isbn);
+        //Se manda el mensaje en el pipe y se espera la respuesta del receptor
+        enviarOperacion(fd, pid, pipeRecibe, fdResp, &op);
 
         //Verificación en caso de que el usuario quiera digitar más opciones o no
         int cont = -1;
@@ -164,8 +247,8 @@ void menu(int fd, pid_t pid, const char *pipeRecibe, int fdResp) {
 //Función principal del solicitante. Inicializa los pipes y ejecuta el modo interactivo o de archivo
 int main(int argc, char *argv[]) {
     //Se verifica el número de argumentos pasados, para ver si es válido o no
-    if (argc != 3 && argc != 5) {
-        printf("\n\tUse: $./solicitante [-i file] -p pipeReceptor\n");
+    if (argc != 3 && argc != 5 && argc != 7) {
+        printf("\n\tUse: $./solicitante [-i file] [-b sucursal] -p pipeReceptor\n");
         exit(1);
     }
     //Variables por si toca guardar datos según lo que se pase de argumento
@@ -178,17 +261,24 @@ int main(int argc, char *argv[]) {
             pipeRec = argv[++i];
         } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
             nomArchivo = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            sucursal = argv[++i];
         }
     }
 
+    //La sucursal viaja como un campo del mensaje, así que no puede estar vacía ni tener comas
+    if (sucursal[0] == '\0' || strlen(sucursal) > 63 || strchr(sucursal, ',')) {
+        printf("\n\tError: Sucursal inválida %s\n", sucursal);
+        exit(1);
+    }
     //Se cierra el programa en caso de no haber nombre de pipe 
     if (!pipeRec) {
         printf("\n\tError: Debe especificar un pipe receptor con -p\n");
         exit(1);
     }
 
-    // Se intenta abrir el pipe en modo escritura
-    int fd = open(pipeRec, O_WRONLY);
+    // Se intenta abrir el pipe en modo escritura, esperando a que el receptor esté listo
+    int fd = conectarReceptor(pipeRec);
     if (fd < 0) {
         printf("Error al abrir el pipe %s\n", pipeRec);
         exit(1);
@@ -208,7 +298,8 @@ int main(int argc, char *argv[]) {
     }
 
     //Se intenta abrir este nuevo pipe que recibe respuestas del receptor
-    int fdResp = open(pipeRecibe, O_RDWR);  //abierto en ambos sentidos para evitar problemas
+    //abierto en ambos sentidos para evitar problemas, y sin bloqueo porque las lecturas se esperan con poll
+    int fdResp = open(pipeRecibe, O_RDWR | O_NONBLOCK);
     if (fdResp < 0) {
         printf("Error al abrir el pipe de respuesta %s\n", pipeRecibe);
         close(fd);
@@ -12,6 +12,17 @@
 #ifndef SOLICITANTE_H
 #define SOLICITANTE_H
 
+// Tiempo máximo (ms) que el receptor debe respetar antes de descartar una operación
+#define PLAZO_MS 1000
+// Veces que se reintenta una operación cuando el receptor responde que está ocupado
+#define MAX_REINTENTOS 5
+// Tiempo máximo (ms) que se espera una respuesta: el plazo del receptor más un margen para procesarla y enviarla
+#define ESPERA_RESPUESTA_MS (PLAZO_MS + 500)
+// Espera inicial y máxima (ms) entre intentos de conexión al receptor, y tiempo total antes de rendirse
+#define CONEXION_INICIAL_MS 10
+#define CONEXION_MAX_MS 1000
+#define ESPERA_CONEXION_MS 10000
+
 // Estructura que representa una operación enviada al receptor.
 struct Operaciones {
     char tipo;
@@ -19,8 +30,15 @@ struct Operaciones {
     int isbn;
 };
 
+// Sucursal a la que se envían las operaciones
+extern const char *sucursal;
+
 // Funciones del solicitante
-void leerRespuesta(int fdResp, const char *pipeRecibe, char tipo, int isbn);
+long long tiempoMs();
+int conectarReceptor(const char *pipeRec);
+void descartarRespuestas(int fdResp);
+int leerRespuesta(int fdResp, const char *pipeRecibe, char tipo, int isbn);
+void enviarOperacion(int fd, pid_t pid, const char *pipeRecibe, int fdResp, struct Operaciones *op);
 void leerArchivo(char *nomArchivo, int fd, pid_t pid, const char *pipeRecibe, int fdResp);
 void menu(int fd, pid_t pid, const char *pipeRecibe, int fdResp);
 